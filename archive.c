@@ -0,0 +1,707 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "syslogd.h"
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+/* nice value of the archive thread */
+#define ARCHIVE_NICE 19
+
+/*
+  Maximum number of fds of rotated files queued for the archive thread.
+  Beyond that, the files are finished synchronously.
+ */
+#define ARCHIVE_MAX_FDS 32
+
+#define COMPRESS_CHUNK 65536
+
+/* suffix of archives that are still being written */
+#define TMP_SUFFIX ".tmp"
+
+typedef struct job_t {
+	struct job_t *next;
+
+	/* fd of the file to finish first, or -1 */
+	int fd;
+	int flags;
+
+	char path[];
+} job_t;
+
+static const char *suffixes[] = {
+	[COMPRESS_NONE] = "",
+	[COMPRESS_GZIP] = ".gz",
+	[COMPRESS_ZSTD] = ".zst",
+};
+
+static int method = COMPRESS_NONE;
+static pthread_t worker;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static job_t *queue_head = NULL;
+static job_t *queue_tail = NULL;
+static bool stop = false;
+static bool running = false;
+
+/*
+  Set if the thread is only needed to finish rotated files, in which case
+  it is started when the first one is handed over.
+ */
+static bool on_demand = false;
+static unsigned int queued_fds = 0;
+
+/* disk budget, and set if the daemon asked to enforce it */
+static uint64_t budget = 0;
+static bool over_budget = false;
+
+int compress_method_from_string(const char *name)
+{
+	if (strcmp(name, "none") == 0)
+		return COMPRESS_NONE;
+#ifdef HAVE_ZLIB_H
+	if (strcmp(name, "gzip") == 0)
+		return COMPRESS_GZIP;
+#endif
+#ifdef HAVE_ZSTD_H
+	if (strcmp(name, "zstd") == 0)
+		return COMPRESS_ZSTD;
+#endif
+	return -1;
+}
+
+static bool stopping(void)
+{
+	return __atomic_load_n(&stop, __ATOMIC_RELAXED);
+}
+
+static int write_all(int fd, const void *data, size_t size)
+{
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = write(fd, data, size);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		data = (const char *)data + ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static ssize_t read_retry(int fd, void *data, size_t size)
+{
+	ssize_t ret;
+
+	do {
+		ret = read(fd, data, size);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+/*****************************************************************************/
+
+/*
+  The compressors return 0 on success, -1 with errno set if reading or
+  writing failed, or -1 with errno set to 0 on a compressor error or if
+  compression was aborted because the daemon is shutting down.
+ */
+
+#ifdef HAVE_ZLIB_H
+static int compress_gzip(int in, int out)
+{
+	static unsigned char ibuf[COMPRESS_CHUNK], obuf[COMPRESS_CHUNK];
+	int ret, flush, status = -1;
+	ssize_t count;
+	z_stream z;
+
+	memset(&z, 0, sizeof(z));
+
+	/* window bits + 16 selects a gzip header instead of zlib */
+	if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+		errno = 0;
+		return -1;
+	}
+
+	do {
+		if (stopping()) {
+			errno = 0;
+			goto out;
+		}
+
+		count = read_retry(in, ibuf, sizeof(ibuf));
+		if (count < 0)
+			goto out;
+
+		flush = count == 0 ? Z_FINISH : Z_NO_FLUSH;
+		z.next_in = ibuf;
+		z.avail_in = count;
+
+		do {
+			z.next_out = obuf;
+			z.avail_out = sizeof(obuf);
+
+			ret = deflate(&z, flush);
+			if (ret == Z_STREAM_ERROR) {
+				errno = 0;
+				goto out;
+			}
+
+			if (write_all(out, obuf, sizeof(obuf) - z.avail_out))
+				goto out;
+		} while (z.avail_out == 0);
+	} while (flush != Z_FINISH);
+
+	status = 0;
+out:
+	deflateEnd(&z);
+	return status;
+}
+#endif
+
+#ifdef HAVE_ZSTD_H
+static int compress_zstd(int in, int out)
+{
+	static unsigned char ibuf[COMPRESS_CHUNK], obuf[COMPRESS_CHUNK];
+	ZSTD_inBuffer input;
+	ZSTD_outBuffer output;
+	ZSTD_EndDirective mode;
+	int status = -1;
+	ZSTD_CCtx *cctx;
+	ssize_t count;
+	size_t ret;
+
+	cctx = ZSTD_createCCtx();
+	if (cctx == NULL) {
+		errno = 0;
+		return -1;
+	}
+
+	do {
+		if (stopping()) {
+			errno = 0;
+			goto out;
+		}
+
+		count = read_retry(in, ibuf, sizeof(ibuf));
+		if (count < 0)
+			goto out;
+
+		mode = count == 0 ? ZSTD_e_end : ZSTD_e_continue;
+		input.src = ibuf;
+		input.size = count;
+		input.pos = 0;
+
+		do {
+			output.dst = obuf;
+			output.size = sizeof(obuf);
+			output.pos = 0;
+
+			ret = ZSTD_compressStream2(cctx, &output, &input, mode);
+			if (ZSTD_isError(ret)) {
+				errno = 0;
+				goto out;
+			}
+
+			if (write_all(out, obuf, output.pos))
+				goto out;
+		} while (mode == ZSTD_e_end ? ret != 0 :
+			 input.pos < input.size);
+	} while (mode != ZSTD_e_end);
+
+	status = 0;
+out:
+	ZSTD_freeCCtx(cctx);
+	return status;
+}
+#endif
+
+static int run_compressor(int in, int out)
+{
+	switch (method) {
+#ifdef HAVE_ZLIB_H
+	case COMPRESS_GZIP:
+		return compress_gzip(in, out);
+#endif
+#ifdef HAVE_ZSTD_H
+	case COMPRESS_ZSTD:
+		return compress_zstd(in, out);
+#endif
+	default:
+		break;
+	}
+
+	(void)in;
+	(void)out;
+	errno = 0;
+	return -1;
+}
+
+/*****************************************************************************/
+
+static void report(const char *path, const char *what)
+{
+	if (errno != 0) {
+		fprintf(stderr, "compressing %s: %s: %s\n", path, what,
+			strerror(errno));
+	} else if (!stopping()) {
+		fprintf(stderr, "compressing %s: %s failed\n", path, what);
+	}
+
+	if (!stopping())
+		STATS_ADD(stats.compress_errors, 1);
+}
+
+/*
+  The archive is written to a temporary file that is only renamed to its
+  final name once it is complete and synced, and the original is removed
+  after that. A crash at any point leaves either the original file, or
+  the complete archive (possibly along with the original).
+
+  The archive gets the modification time of the original, so the
+  retention policy sees the time of the rotation. Returns the name of
+  the archive, or NULL if the original is left in place.
+ */
+static char *compress_file(const char *path)
+{
+	size_t len = strlen(path), slen = strlen(suffixes[method]);
+	struct timespec times[2];
+	struct stat sb, now;
+	char *archive, *tmp;
+	int in, out, dfd;
+
+	archive = malloc(len + slen + 1);
+	if (archive == NULL) {
+		report(path, "malloc");
+		return NULL;
+	}
+
+	memcpy(archive, path, len);
+	strcpy(archive + len, suffixes[method]);
+
+	tmp = alloca(len + slen + sizeof(TMP_SUFFIX));
+	sprintf(tmp, "%s" TMP_SUFFIX, archive);
+
+	in = open(path, O_RDONLY | O_CLOEXEC);
+	if (in < 0) {
+		if (errno != ENOENT)
+			report(path, "open");
+		free(archive);
+		return NULL;
+	}
+
+	if (fstat(in, &sb)) {
+		report(path, "stat");
+		close(in);
+		free(archive);
+		return NULL;
+	}
+
+	out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if (out < 0) {
+		report(tmp, "open");
+		close(in);
+		free(archive);
+		return NULL;
+	}
+
+	if (run_compressor(in, out)) {
+		report(path, "compression");
+		goto fail;
+	}
+
+	times[0] = sb.st_atim;
+	times[1] = sb.st_mtim;
+	futimens(out, times);
+
+	if (fsync(out)) {
+		report(tmp, "fsync");
+		goto fail;
+	}
+
+	if (close(out)) {
+		out = -1;
+		report(tmp, "close");
+		goto fail;
+	}
+
+	close(in);
+
+	if (rename(tmp, archive)) {
+		report(archive, "rename");
+		unlink(tmp);
+		free(archive);
+		return NULL;
+	}
+
+	dfd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd >= 0) {
+		fsync(dfd);
+		close(dfd);
+	}
+
+	/*
+	  With --rotate-replace, the original may have been replaced by a
+	  newer rotated file in the meantime, which must not be removed.
+	 */
+	if (stat(path, &now) == 0 && now.st_ino == sb.st_ino &&
+	    now.st_dev == sb.st_dev) {
+		unlink(path);
+	}
+
+	STATS_ADD(stats.compressed, 1);
+	STATS_ADD(stats.compress_in_bytes, sb.st_size);
+	if (stat(archive, &now) == 0)
+		STATS_ADD(stats.compress_out_bytes, now.st_size);
+	return archive;
+fail:
+	if (out >= 0)
+		close(out);
+	close(in);
+	unlink(tmp);
+	free(archive);
+	return NULL;
+}
+
+/*
+  Write the data of a rotated file to disk and close it. Called by the
+  archive thread, or by the daemon if the thread is not keeping up.
+ */
+static void finish_file(const char *path, int fd, int flags)
+{
+	struct stat sb;
+	int ret = 0;
+
+	if (flags & ARCHIVE_DATASYNC) {
+		ret = fdatasync(fd);
+	} else if (flags & ARCHIVE_SYNC) {
+		ret = fsync(fd);
+	}
+
+	if (ret == 0 && (flags & ARCHIVE_TRIM)) {
+		ret = fstat(fd, &sb);
+		if (ret == 0)
+			ret = ftruncate(fd, sb.st_size);
+	}
+
+	if (close(fd) != 0 && ret == 0)
+		ret = -1;
+
+	if (ret != 0) {
+		fprintf(stderr, "finishing %s: %s\n", path, strerror(errno));
+		/* called by both the archive thread and the daemon */
+		__atomic_fetch_add(&stats.archive_errors, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void process(job_t *job)
+{
+	char *archive = NULL;
+
+	if (job->fd >= 0) {
+		finish_file(job->path, job->fd, job->flags);
+
+		pthread_mutex_lock(&lock);
+		queued_fds -= 1;
+		pthread_mutex_unlock(&lock);
+	}
+
+	if (method != COMPRESS_NONE)
+		archive = compress_file(job->path);
+
+	if (!stopping())
+		retention_add(archive != NULL ? archive : job->path);
+
+	free(archive);
+}
+
+static void *archive_worker(void *arg)
+{
+	struct timespec deadline;
+	time_t next;
+	job_t *job;
+	(void)arg;
+
+	/* on Linux, a thread ID can be used to set the nice value */
+	setpriority(PRIO_PROCESS, gettid(), ARCHIVE_NICE);
+
+	retention_scan(method != COMPRESS_NONE);
+
+	pthread_mutex_lock(&lock);
+
+	for (;;) {
+		__atomic_store_n(&over_budget, false, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&lock);
+		next = retention_expire(time(NULL));
+		retention_budget(__atomic_load_n(&stats.live_bytes,
+						 __ATOMIC_RELAXED));
+		pthread_mutex_lock(&lock);
+
+		while (queue_head == NULL && !stop && !over_budget) {
+			if (next == 0) {
+				pthread_cond_wait(&cond, &lock);
+				continue;
+			}
+
+			deadline.tv_sec = next;
+			deadline.tv_nsec = 0;
+
+			if (pthread_cond_timedwait(&cond, &lock,
+						   &deadline) == ETIMEDOUT) {
+				break;
+			}
+		}
+
+		/*
+		  Remaining fds are finished by archive_cleanup(), the files
+		  are picked up again on the next start.
+		 */
+		if (stop)
+			break;
+
+		/* timed out, or woken up by archive_check_budget() */
+		if (queue_head == NULL)
+			continue;
+
+		job = queue_head;
+		queue_head = job->next;
+		if (queue_head == NULL)
+			queue_tail = NULL;
+
+		pthread_mutex_unlock(&lock);
+		process(job);
+		free(job);
+		pthread_mutex_lock(&lock);
+	}
+
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+static int archive_start(void)
+{
+	int ret;
+
+	running = true;
+
+	ret = pthread_create(&worker, NULL, archive_worker, NULL);
+	if (ret != 0) {
+		fprintf(stderr, "creating archive thread: %s\n",
+			strerror(ret));
+		running = false;
+		return -1;
+	}
+
+	return 0;
+}
+
+void archive_submit(const char *path, int fd, int flags)
+{
+	size_t len = strlen(path);
+	job_t *job;
+
+	if (on_demand && fd >= 0) {
+		on_demand = false;
+		archive_start();
+	}
+
+	job = calloc(1, sizeof(*job) + len + 1);
+	if (job == NULL) {
+		perror("calloc");
+		goto sync;
+	}
+
+	memcpy(job->path, path, len);
+	job->fd = fd;
+	job->flags = flags;
+
+	pthread_mutex_lock(&lock);
+	if (!running || (fd >= 0 && queued_fds >= ARCHIVE_MAX_FDS)) {
+		pthread_mutex_unlock(&lock);
+		free(job);
+		goto sync;
+	}
+
+	if (fd >= 0)
+		queued_fds += 1;
+
+	if (queue_tail == NULL) {
+		queue_head = job;
+	} else {
+		queue_tail->next = job;
+	}
+	queue_tail = job;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+	return;
+sync:
+	/* compression and retention catch up with the next start */
+	if (fd >= 0)
+		finish_file(path, fd, flags);
+}
+
+static bool has_suffix(const char *name, size_t len, const char *suffix)
+{
+	size_t slen = strlen(suffix);
+
+	return len >= slen && strcmp(name + len - slen, suffix) == 0;
+}
+
+/*
+  Clean up after a crash or an unclean shutdown: remove partially written
+  archives, remove originals that already have a complete archive, and
+  compress rotated files that were not compressed yet.
+ */
+static void compress_recover(void)
+{
+	char archive[NAME_MAX + 16];
+	struct dirent *ent;
+	struct stat sb;
+	size_t i, len;
+	bool done;
+	DIR *dir;
+
+	dir = opendir(".");
+	if (dir == NULL) {
+		perror("scanning for rotated log files");
+		return;
+	}
+
+	while ((ent = readdir(dir)) != NULL) {
+		/* rotated files are named <stream>.log.<suffix> */
+		if (strstr(ent->d_name, ".log.") == NULL)
+			continue;
+
+		len = strlen(ent->d_name);
+
+		if (has_suffix(ent->d_name, len, TMP_SUFFIX)) {
+			unlink(ent->d_name);
+			continue;
+		}
+
+		done = false;
+
+		for (i = COMPRESS_NONE + 1;
+		     i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+			if (has_suffix(ent->d_name, len, suffixes[i]))
+				done = true;
+		}
+
+		if (done)
+			continue;
+
+		snprintf(archive, sizeof(archive), "%s%s", ent->d_name,
+			 suffixes[method]);
+
+		if (lstat(ent->d_name, &sb) != 0 || !S_ISREG(sb.st_mode))
+			continue;
+
+		if (stat(archive, &sb) == 0) {
+			unlink(ent->d_name);
+		} else {
+			archive_submit(ent->d_name, -1, 0);
+		}
+	}
+
+	closedir(dir);
+}
+
+void archive_check_budget(void)
+{
+	uint64_t live, rotated;
+
+	if (budget == 0 || __atomic_load_n(&over_budget, __ATOMIC_RELAXED))
+		return;
+
+	live = __atomic_load_n(&stats.live_bytes, __ATOMIC_RELAXED);
+	rotated = __atomic_load_n(&stats.rotated_bytes, __ATOMIC_RELAXED);
+
+	if (rotated == 0 || live + rotated <= budget)
+		return;
+
+	pthread_mutex_lock(&lock);
+	__atomic_store_n(&over_budget, true, __ATOMIC_RELAXED);
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+int archive_init(int m, const retention_t *retention)
+{
+	method = m;
+	budget = retention->budget;
+	retention_init(retention);
+
+	/*
+	  Without compression and retention, there is nothing to clean up
+	  or to scan for, and no thread if no backend rotates files.
+	 */
+	if (method == COMPRESS_NONE && retention->count == 0 &&
+	    retention->max_age == 0 && retention->bytes == 0 &&
+	    retention->budget == 0) {
+		on_demand = true;
+		return 0;
+	}
+
+	if (method != COMPRESS_NONE)
+		compress_recover();
+
+	if (archive_start()) {
+		archive_cleanup();
+		return -1;
+	}
+
+	return 0;
+}
+
+void archive_cleanup(void)
+{
+	job_t *job;
+
+	if (running) {
+		pthread_mutex_lock(&lock);
+		__atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&lock);
+
+		pthread_join(worker, NULL);
+		running = false;
+	}
+
+	while (queue_head != NULL) {
+		job = queue_head;
+		queue_head = job->next;
+		if (job->fd >= 0)
+			finish_file(job->path, job->fd, job->flags);
+		free(job);
+	}
+
+	queue_tail = NULL;
+	queued_fds = 0;
+	on_demand = false;
+	method = COMPRESS_NONE;
+	retention_cleanup();
+}
@@ -0,0 +1,313 @@
+/* SPDX-License-Identifier: ISC */
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "syslogd.h"
+
+#define NUM_MESSAGES 1000000
+
+static const char *months[] = {
+	"Jan", "Feb", "Mar", "Apr",
+	"May", "Jun", "Jul", "Aug",
+	"Sep", "Oct", "Nov", "Dec"
+};
+
+static const char *zones[] = {
+	"UTC",
+	"Europe/Vienna",
+	"America/New_York",
+	"Australia/Lord_Howe",
+};
+
+static volatile time_t sink;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+  The message parser from proto.c before the time stamp fast path was
+  added, i.e. time() and localtime_r() for every message followed by
+  mktime(). Except for setting tm_isdst to -1 (the old code left it at
+  0), this is exactly what the parser used to do.
+ */
+static const int days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+static int isleap(int year)
+{
+	return ((year % 4 == 0) && (year % 100 != 0)) || ((year % 400) == 0);
+}
+
+static int mdays(int year, int month)
+{
+	if (month < 1 || month > 12)
+		return 0;
+	return (isleap(year) && month == 2) ? 29 : days[month - 1];
+}
+
+static char *read_num(char *str, int *out, int maxval)
+{
+	if (str == NULL || !isdigit(*str))
+		return NULL;
+	for (*out = 0; isdigit(*str); ++str) {
+		(*out) = (*out) * 10 + (*str) - '0';
+		if ((*out) > maxval)
+			return NULL;
+	}
+	return str;
+}
+
+static char *skip_space(char *str)
+{
+	if (str == NULL || !isspace(*str))
+		return NULL;
+	while (isspace(*str))
+		++str;
+	return str;
+}
+
+static char *read_date_bsd(char *str, struct tm *tm)
+{
+	int year, month, day, hour, minute, second;
+	time_t t;
+
+	/* decode date */
+	for (month = 0; month < 12; ++month) {
+		if (strncmp(str, months[month], 3) == 0) {
+			str = skip_space(str + 3);
+			break;
+		}
+	}
+
+	str = read_num(str, &day, 31);
+	str = skip_space(str);
+
+	t = time(NULL);
+	if (localtime_r(&t, tm) == NULL)
+		return NULL;
+
+	year = tm->tm_year;
+
+	/* sanity check */
+	if (str == NULL || month >= 12 || day < 1)
+		return NULL;
+	if (month == 11 && tm->tm_mon == 0)
+		--year;
+	if (day > mdays(year + 1900, month + 1))
+		return NULL;
+
+	/* decode time */
+	str = read_num(str, &hour, 23);
+	if (str == NULL || *(str++) != ':')
+		return NULL;
+	str = read_num(str, &minute, 59);
+	if (str == NULL || *(str++) != ':')
+		return NULL;
+	str = read_num(str, &second, 59);
+	str = skip_space(str);
+
+	/* store result */
+	memset(tm, 0, sizeof(*tm));
+	tm->tm_isdst = -1;
+	tm->tm_sec = second;
+	tm->tm_min = minute;
+	tm->tm_hour = hour;
+	tm->tm_mday = day;
+	tm->tm_mon = month;
+	tm->tm_year = year;
+	return str;
+}
+
+static char *decode_priority(char *str, int *priority)
+{
+	while (isspace(*str))
+		++str;
+	if (*(str++) != '<')
+		return NULL;
+	str = read_num(str, priority, 23 * 8 + 7);
+	if (str == NULL || *(str++) != '>')
+		return NULL;
+	while (isspace(*str))
+		++str;
+	return str;
+}
+
+static int reference_msg_parse(syslog_msg_t *msg, char *str)
+{
+	char *ident, *ptr;
+	struct tm tstamp;
+	pid_t pid = 0;
+	int priority;
+	size_t len;
+
+	memset(msg, 0, sizeof(*msg));
+
+	str = decode_priority(str, &priority);
+	if (str == NULL)
+		return -1;
+
+	msg->facility = priority >> 3;
+	msg->level = priority & 0x07;
+
+	str = read_date_bsd(str, &tstamp);
+	if (str == NULL)
+		return -1;
+
+	ident = str;
+	while (*str != '\0' && *str != ':')
+		++str;
+
+	if (*str == ':') {
+		*(str++) = '\0';
+		while (isspace(*str))
+			++str;
+
+		ptr = ident;
+		while (*ptr != '[' && *ptr != '\0')
+			++ptr;
+
+		if (*ptr == '[') {
+			*(ptr++) = '\0';
+
+			while (isdigit(*ptr))
+				pid = pid * 10 + *(ptr++) - '0';
+		}
+	} else {
+		ident = NULL;
+	}
+
+	if (ident != NULL && ident[0] == '\0')
+		ident = NULL;
+
+	msg->timestamp = mktime(&tstamp);
+	msg->pid = pid;
+	msg->ident = ident;
+	msg->message = str;
+
+	len = strlen(str);
+	while (len > 0 && isspace(str[len - 1]))
+		--len;
+	str[len] = '\0';
+
+	if (ident != NULL) {
+		for (ptr = ident; *ptr != '\0'; ++ptr) {
+			if (!isalnum(*ptr))
+				*ptr = '_';
+		}
+	}
+
+	return 0;
+}
+
+static void make_message(char *buffer, size_t size, time_t t)
+{
+	struct tm tm;
+
+	localtime_r(&t, &tm);
+	snprintf(buffer, size, "<13>%s %2d %02d:%02d:%02d bench[42]: test",
+		 months[tm.tm_mon], tm.tm_mday, tm.tm_hour, tm.tm_min,
+		 tm.tm_sec);
+}
+
+/*
+  Pretend the current time is each point in a year and check that
+  messages from a while ago decode to the same time stamps as with
+  mktime(), including across DST transitions.
+ */
+static int check_zone(const char *zone, time_t start)
+{
+	static const time_t ago[] = { 0, 1, 59, 600, 3000, 3599, 3600, 7200,
+				      86400, 3 * 86400 };
+	char buffer[128], copy[128];
+	syslog_msg_t msg;
+	struct tm tm;
+	time_t now, t, ref;
+	size_t i;
+
+	setenv("TZ", zone, 1);
+	tzset();
+
+	for (now = start; now < start + 366 * 86400L; now += 1931) {
+		syslog_clock_update(now);
+
+		for (i = 0; i < sizeof(ago) / sizeof(ago[0]); ++i) {
+			t = now - ago[i];
+			make_message(buffer, sizeof(buffer), t);
+			strcpy(copy, buffer);
+
+			if (syslog_msg_parse(&msg, copy))
+				goto fail;
+
+			localtime_r(&t, &tm);
+			tm.tm_isdst = -1;
+			ref = mktime(&tm);
+
+			/*
+			  During the hour after switching back from DST,
+			  the local time is ambiguous. mktime() may pick
+			  either, the fast path picks the recent one.
+			 */
+			if (msg.timestamp != ref && msg.timestamp != t)
+				goto fail;
+		}
+	}
+
+	printf("  %-20s ok\n", zone);
+	return 0;
+fail:
+	printf("  %-20s FAILED for '%s' at %ld: got %ld\n", zone, buffer,
+	       (long)now, (long)msg.timestamp);
+	return -1;
+}
+
+static double run(int (*parse)(syslog_msg_t *, char *), const char *buffer)
+{
+	char copy[128];
+	syslog_msg_t msg;
+	double start;
+	long i;
+
+	start = now_sec();
+
+	for (i = 0; i < NUM_MESSAGES; ++i) {
+		strcpy(copy, buffer);
+		parse(&msg, copy);
+		sink += msg.timestamp;
+	}
+
+	return (now_sec() - start) * 1e9 / NUM_MESSAGES;
+}
+
+int main(void)
+{
+	char buffer[128];
+	time_t now = time(NULL);
+	int ret = EXIT_SUCCESS;
+	size_t i;
+
+	puts("BSD time stamp decoding, compared with mktime():");
+
+	for (i = 0; i < sizeof(zones) / sizeof(zones[0]); ++i) {
+		if (check_zone(zones[i], now - 366 * 86400L))
+			ret = EXIT_FAILURE;
+	}
+
+	setenv("TZ", "Europe/Vienna", 1);
+	tzset();
+	syslog_clock_update(now);
+	make_message(buffer, sizeof(buffer), now);
+
+	puts("BSD time stamp decoding, Europe/Vienna:");
+	printf("  previous parser (mktime): %6.1f ns/message\n",
+	       run(reference_msg_parse, buffer));
+	printf("  syslog_msg_parse:         %6.1f ns/message\n",
+	       run(syslog_msg_parse, buffer));
+	return ret;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# SPDX-License-Identifier: ISC
+#
+# End to end benchmark: start usyslogd on a private socket and log
+# directory, run the load generator against it and stop the daemon again.
+#
+# Usage: e2e.sh [loadgen options]
+#
+# Options for usyslogd can be passed through the USYSLOGD_OPTS environment
+# variable. Both programs are expected in the current directory.
+set -e
+
+tmp=$(mktemp -d)
+pid=""
+
+cleanup() {
+	if [ -n "$pid" ]; then
+		kill "$pid" 2>/dev/null || true
+		wait "$pid" 2>/dev/null || true
+	fi
+	rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+./usyslogd -S "$tmp/log.sock" -d "$tmp/logs" -u "$(id -un)" -g "$(id -gn)" \
+	   $USYSLOGD_OPTS &
+pid=$!
+
+i=0
+while [ ! -S "$tmp/log.sock" ]; do
+	i=$((i + 1))
+	if [ $i -gt 50 ] || ! kill -0 "$pid" 2>/dev/null; then
+		echo "usyslogd did not start" >&2
+		exit 1
+	fi
+	sleep 0.1
+done
+
+echo "usyslogd $USYSLOGD_OPTS"
+./loadgen -S "$tmp/log.sock" -d "$tmp/logs" "$@"
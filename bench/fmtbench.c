@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: ISC */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "syslogd.h"
+
+#define NUM_MESSAGES 2000000
+#define MSG_PER_SECOND 1000
+
+static volatile size_t sink;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the way log lines were formatted before format_prefix() existed */
+static size_t reference_prefix(char *out, const syslog_msg_t *msg,
+			       bool facility)
+{
+	char timebuf[32];
+	struct tm tm;
+
+	gmtime_r(&msg->timestamp, &tm);
+	strftime(timebuf, sizeof(timebuf), "%FT%T", &tm);
+
+	if (facility) {
+		return sprintf(out, "[%s][%s][%s][%u] ", timebuf,
+			       facility_id_to_string(msg->facility),
+			       level_id_to_string(msg->level), msg->pid);
+	}
+
+	return sprintf(out, "[%s][%s][%u] ", timebuf,
+		       level_id_to_string(msg->level), msg->pid);
+}
+
+static double run(size_t (*fun)(char *, const syslog_msg_t *, bool))
+{
+	char buffer[FORMAT_PREFIX_MAX];
+	syslog_msg_t msg;
+	double start;
+	long i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.timestamp = 1539684000;
+	msg.ident = "bench";
+	start = now_sec();
+
+	for (i = 0; i < NUM_MESSAGES; ++i) {
+		if ((i % MSG_PER_SECOND) == 0)
+			msg.timestamp += 1;
+
+		msg.facility = i % SYSLOG_NUM_FACILITIES;
+		msg.level = i % SYSLOG_NUM_LEVELS;
+		msg.pid = 100 + i % 30000;
+
+		sink += fun(buffer, &msg, (i & 1) != 0);
+	}
+
+	return (now_sec() - start) * 1e9 / NUM_MESSAGES;
+}
+
+static int check(void)
+{
+	char a[FORMAT_PREFIX_MAX], b[FORMAT_PREFIX_MAX];
+	syslog_msg_t msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.timestamp = 1539684000;
+	msg.facility = 4;
+	msg.level = 2;
+	msg.pid = 4711;
+
+	reference_prefix(a, &msg, true);
+	format_prefix(b, &msg, true);
+	if (strcmp(a, b) != 0)
+		goto fail;
+
+	reference_prefix(a, &msg, false);
+	format_prefix(b, &msg, false);
+	if (strcmp(a, b) != 0)
+		goto fail;
+
+	return 0;
+fail:
+	fprintf(stderr, "fmtbench: output mismatch:\n  '%s'\n  '%s'\n", a, b);
+	return -1;
+}
+
+int main(void)
+{
+	if (check())
+		return EXIT_FAILURE;
+
+	printf("log line prefix, %d messages per second of time stamp:\n",
+	       MSG_PER_SECOND);
+	printf("  sprintf/strftime: %6.1f ns/message\n",
+	       run(reference_prefix));
+	printf("  format_prefix:    %6.1f ns/message\n",
+	       run(format_prefix));
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,555 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_COUNT 100000
+#define DEFAULT_SIZE 128
+#define DEFAULT_IDENTS 16
+#define DEFAULT_DRAIN 5
+
+/* messages are never larger than what usyslogd accepts */
+#define MAX_SIZE 2047
+#define MIN_SIZE 64
+
+/* log files are listed individually up to this count */
+#define MAX_FILES_LISTED 16
+
+static const struct option long_opts[] = {
+	{ "help", no_argument, NULL, 'h' },
+	{ "socket", required_argument, NULL, 'S' },
+	{ "log-dir", required_argument, NULL, 'd' },
+	{ "threads", required_argument, NULL, 'p' },
+	{ "count", required_argument, NULL, 'n' },
+	{ "size", required_argument, NULL, 's' },
+	{ "idents", required_argument, NULL, 'i' },
+	{ "rate", required_argument, NULL, 'r' },
+	{ "drain", required_argument, NULL, 'w' },
+	{ NULL, 0, NULL, 0 },
+};
+
+static const char *short_opts = "hS:d:p:n:s:i:r:w:";
+
+static const char *usage_string =
+"Usage: loadgen [OPTIONS..]\n\n"
+"Send syslog messages to a socket from several threads at once and\n"
+"measure how well the daemon behind it keeps up.\n\n"
+"The following options are supported:\n"
+"  -h, --help             Print this help text and exit\n"
+"  -S, --socket <path>    Send messages to this socket. Default is /dev/log.\n"
+"  -d, --log-dir <path>   Directory the daemon writes log files to. If set,\n"
+"                         the log files are followed to measure end to end\n"
+"                         latency and the bytes written per file. Should be\n"
+"                         empty and the daemon should not rotate files.\n"
+"  -p, --threads <count>  Number of sending threads. Default is %d.\n"
+"  -n, --count <count>    Messages sent by each thread. Default is %d.\n"
+"  -s, --size <bytes>     Size of each datagram, between %d and %d.\n"
+"                         Default is %d.\n"
+"  -i, --idents <count>   Number of distinct idents (i.e. log files) the\n"
+"                         messages are spread over. Default is %d.\n"
+"  -r, --rate <count>     Total messages per second over all threads.\n"
+"                         Default is to send as fast as possible.\n"
+"  -w, --drain <seconds>  After sending, wait at most this long without\n"
+"                         progress for messages to show up in the log\n"
+"                         files. Default is %d.\n";
+
+typedef struct {
+	pthread_t thread;
+	unsigned int id;
+	bool joined;
+
+	/* time spent in send(), in nanoseconds */
+	uint64_t blocked;
+	uint64_t max_blocked;
+
+	uint64_t sent;
+	uint64_t failed;
+} sender_t;
+
+typedef struct {
+	int fd;
+	char name[32];
+
+	/* incomplete last line */
+	char carry[MAX_SIZE + 256];
+	size_t carry_len;
+} tail_t;
+
+static const char *socket_path = "/dev/log";
+static const char *log_dir = NULL;
+static unsigned int num_threads = DEFAULT_THREADS;
+static unsigned long count = DEFAULT_COUNT;
+static unsigned long msg_size = DEFAULT_SIZE;
+static unsigned int num_idents = DEFAULT_IDENTS;
+static unsigned long rate = 0;
+static unsigned int drain = DEFAULT_DRAIN;
+
+static struct sockaddr_un addr;
+static volatile int start_flag = 0;
+
+/* end to end latency of each message seen in the log files, microseconds */
+static uint32_t *latencies;
+static size_t num_latencies;
+static size_t max_latencies;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline)
+{
+	struct timespec ts;
+
+	ts.tv_sec = deadline / 1000000000ULL;
+	ts.tv_nsec = deadline % 1000000000ULL;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+/*
+  Messages look like "<13>Oct 16 10:00:00 lg3[42]: 1:42 t=123 xxx...",
+  i.e. the thread id and sequence number, followed by the monotonic
+  send time in nanoseconds and padding up to the requested size.
+ */
+static size_t format_message(char *buffer, const char *date,
+			     unsigned int thread, unsigned long seq,
+			     unsigned int ident)
+{
+	int len;
+
+	len = snprintf(buffer, msg_size + 1, "<13>%s lg%u[%d]: %u:%lu t=%llu ",
+		       date, ident, (int)getpid(), thread, seq,
+		       (unsigned long long)now_ns());
+
+	if (len < 0)
+		return 0;
+
+	if ((unsigned long)len > msg_size)
+		len = msg_size;
+
+	if ((unsigned long)len < msg_size) {
+		memset(buffer + len, 'x', msg_size - len);
+		len = msg_size;
+	}
+
+	return len;
+}
+
+static void *sender_main(void *arg)
+{
+	sender_t *s = arg;
+	uint64_t start, t0, t1, interval = 0;
+	char buffer[MAX_SIZE + 1], date[32];
+	time_t now, last = 0;
+	unsigned long i;
+	struct tm tm;
+	size_t len;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return NULL;
+	}
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror(socket_path);
+		close(fd);
+		return NULL;
+	}
+
+	while (!__atomic_load_n(&start_flag, __ATOMIC_ACQUIRE))
+		;
+
+	if (rate > 0)
+		interval = 1000000000ULL * num_threads / rate;
+
+	start = now_ns();
+
+	for (i = 0; i < count; ++i) {
+		if (interval > 0)
+			sleep_until(start + i * interval);
+
+		now = time(NULL);
+		if (now != last) {
+			localtime_r(&now, &tm);
+			strftime(date, sizeof(date), "%b %e %T", &tm);
+			last = now;
+		}
+
+		len = format_message(buffer, date, s->id, i,
+				     (s->id + i * num_threads) % num_idents);
+
+		t0 = now_ns();
+		if (send(fd, buffer, len, 0) < 0) {
+			s->failed += 1;
+		} else {
+			s->sent += 1;
+		}
+		t1 = now_ns();
+
+		s->blocked += t1 - t0;
+		if (t1 - t0 > s->max_blocked)
+			s->max_blocked = t1 - t0;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+/*****************************************************************************/
+
+static void record_line(const char *line, uint64_t now)
+{
+	const char *t = strstr(line, " t=");
+	unsigned long long sent;
+
+	if (t == NULL || num_latencies >= max_latencies)
+		return;
+
+	sent = strtoull(t + 3, NULL, 10);
+	if (sent > now)
+		sent = now;
+
+	latencies[num_latencies++] = (now - sent) / 1000;
+}
+
+/* Read what has been appended to a log file. Returns the bytes read. */
+static size_t tail_read(tail_t *t)
+{
+	char buffer[65536];
+	size_t total = 0;
+	char *line, *end;
+	uint64_t now;
+	ssize_t ret;
+
+	if (t->fd < 0) {
+		t->fd = open(t->name, O_RDONLY | O_CLOEXEC);
+		if (t->fd < 0)
+			return 0;
+	}
+
+	while ((ret = read(t->fd, buffer, sizeof(buffer))) > 0) {
+		now = now_ns();
+		total += ret;
+		line = buffer;
+
+		while ((end = memchr(line, '\n', buffer + ret - line))) {
+			*end = '\0';
+
+			if (t->carry_len > 0) {
+				if (t->carry_len + (end - line) <
+				    sizeof(t->carry)) {
+					memcpy(t->carry + t->carry_len, line,
+					       end - line + 1);
+					record_line(t->carry, now);
+				}
+				t->carry_len = 0;
+			} else {
+				record_line(line, now);
+			}
+
+			line = end + 1;
+		}
+
+		if (line < buffer + ret &&
+		    t->carry_len + (buffer + ret - line) < sizeof(t->carry)) {
+			memcpy(t->carry + t->carry_len, line,
+			       buffer + ret - line);
+			t->carry_len += buffer + ret - line;
+		}
+	}
+
+	return total;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static uint32_t percentile(double p)
+{
+	size_t i = (size_t)(p / 100.0 * (num_latencies - 1) + 0.5);
+
+	return latencies[i];
+}
+
+static void report_files(tail_t *tails)
+{
+	unsigned long long total = 0, min = ULLONG_MAX, max = 0;
+	unsigned int i, files = 0;
+	struct stat sb;
+
+	for (i = 0; i < num_idents; ++i) {
+		if (stat(tails[i].name, &sb))
+			continue;
+
+		files += 1;
+		total += sb.st_size;
+		if ((unsigned long long)sb.st_size < min)
+			min = sb.st_size;
+		if ((unsigned long long)sb.st_size > max)
+			max = sb.st_size;
+
+		if (num_idents <= MAX_FILES_LISTED) {
+			printf("  %-20s %llu bytes\n", tails[i].name,
+			       (unsigned long long)sb.st_size);
+		}
+	}
+
+	if (files == 0) {
+		puts("no log files found");
+		return;
+	}
+
+	printf("bytes written: %llu in %u files, min %llu, avg %llu, "
+	       "max %llu per file\n", total, files, min, total / files, max);
+}
+
+static void process_options(int argc, char **argv)
+{
+	char *end;
+	int i;
+
+	for (;;) {
+		i = getopt_long(argc, argv, short_opts, long_opts, NULL);
+		if (i == -1)
+			break;
+
+		switch (i) {
+		case 'S':
+			socket_path = optarg;
+			break;
+		case 'd':
+			log_dir = optarg;
+			break;
+		case 'p':
+			num_threads = strtoul(optarg, &end, 10);
+			if (num_threads == 0 || *end != '\0')
+				goto fail_num;
+			break;
+		case 'n':
+			count = strtoul(optarg, &end, 10);
+			if (count == 0 || *end != '\0')
+				goto fail_num;
+			break;
+		case 's':
+			msg_size = strtoul(optarg, &end, 10);
+			if (msg_size < MIN_SIZE || msg_size > MAX_SIZE ||
+			    *end != '\0') {
+				fprintf(stderr, "Size must be between %d and "
+					"%d\n", MIN_SIZE, MAX_SIZE);
+				goto fail;
+			}
+			break;
+		case 'i':
+			num_idents = strtoul(optarg, &end, 10);
+			if (num_idents == 0 || *end != '\0')
+				goto fail_num;
+			break;
+		case 'r':
+			rate = strtoul(optarg, &end, 10);
+			if (*end != '\0')
+				goto fail_num;
+			break;
+		case 'w':
+			drain = strtoul(optarg, &end, 10);
+			if (*end != '\0')
+				goto fail_num;
+			break;
+		case 'h':
+			printf(usage_string, DEFAULT_THREADS, DEFAULT_COUNT,
+			       MIN_SIZE, MAX_SIZE, DEFAULT_SIZE,
+			       DEFAULT_IDENTS, DEFAULT_DRAIN);
+			exit(EXIT_SUCCESS);
+		default:
+			goto fail;
+		}
+	}
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", socket_path);
+		exit(EXIT_FAILURE);
+	}
+	return;
+fail_num:
+	fprintf(stderr, "Numeric argument > 0 expected for -%c\n", i);
+fail:
+	fputs("Try `loadgen --help' for more information\n", stderr);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t start, end, last_progress, blocked = 0, max_blocked = 0;
+	unsigned long long sent = 0, failed = 0, total;
+	tail_t *tails = NULL;
+	sender_t *senders;
+	unsigned int i;
+	bool done;
+	double secs;
+
+	process_options(argc, argv);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	total = (unsigned long long)count * num_threads;
+
+	senders = calloc(num_threads, sizeof(senders[0]));
+	if (senders == NULL) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	if (log_dir != NULL) {
+		if (chdir(log_dir)) {
+			perror(log_dir);
+			return EXIT_FAILURE;
+		}
+
+		tails = calloc(num_idents, sizeof(tails[0]));
+		max_latencies = total;
+		latencies = calloc(max_latencies, sizeof(latencies[0]));
+		if (tails == NULL || latencies == NULL) {
+			perror("calloc");
+			return EXIT_FAILURE;
+		}
+
+		for (i = 0; i < num_idents; ++i) {
+			tails[i].fd = -1;
+			sprintf(tails[i].name, "lg%u.log", i);
+		}
+	}
+
+	for (i = 0; i < num_threads; ++i) {
+		senders[i].id = i;
+
+		if (pthread_create(&senders[i].thread, NULL, sender_main,
+				   senders + i)) {
+			fputs("Cannot create sender thread\n", stderr);
+			return EXIT_FAILURE;
+		}
+	}
+
+	start = now_ns();
+	__atomic_store_n(&start_flag, 1, __ATOMIC_RELEASE);
+
+	/* follow the log files while the senders are busy */
+	for (;;) {
+		done = true;
+		for (i = 0; i < num_threads; ++i) {
+			if (senders[i].joined)
+				continue;
+
+			if (pthread_tryjoin_np(senders[i].thread, NULL) == 0) {
+				senders[i].joined = true;
+			} else {
+				done = false;
+			}
+		}
+
+		if (done)
+			break;
+
+		for (i = 0; tails != NULL && i < num_idents; ++i)
+			tail_read(tails + i);
+
+		usleep(tails != NULL ? 200 : 10000);
+	}
+
+	end = now_ns();
+
+	for (i = 0; i < num_threads; ++i) {
+		sent += senders[i].sent;
+		failed += senders[i].failed;
+		blocked += senders[i].blocked;
+		if (senders[i].max_blocked > max_blocked)
+			max_blocked = senders[i].max_blocked;
+	}
+
+	secs = (end - start) / 1e9;
+
+	printf("%u threads, %lu messages each, %lu bytes, %u idents, ",
+	       num_threads, count, msg_size, num_idents);
+	if (rate > 0) {
+		printf("%lu msg/s\n", rate);
+	} else {
+		puts("unlimited rate");
+	}
+
+	printf("sent: %llu in %.3f s, %.0f msg/s, %.1f MiB/s, %llu failed\n",
+	       sent, secs, sent / secs, sent * msg_size / secs / 1048576.0,
+	       failed);
+	printf("blocked in send(): %.3f s total (%.1f%% of sender time), "
+	       "max %.3f ms\n", blocked / 1e9,
+	       100.0 * blocked / ((double)(end - start) * num_threads),
+	       max_blocked / 1e6);
+
+	if (tails == NULL)
+		return EXIT_SUCCESS;
+
+	last_progress = now_ns();
+
+	while (num_latencies < sent &&
+	       now_ns() - last_progress < drain * 1000000000ULL) {
+		done = true;
+		for (i = 0; i < num_idents; ++i) {
+			if (tail_read(tails + i) > 0)
+				done = false;
+		}
+
+		if (!done)
+			last_progress = now_ns();
+		usleep(200);
+	}
+
+	printf("delivered: %zu of %llu (%.2f%%)\n", num_latencies, sent,
+	       sent ? 100.0 * num_latencies / sent : 0.0);
+
+	if (num_latencies > 0) {
+		qsort(latencies, num_latencies, sizeof(latencies[0]),
+		      cmp_u32);
+
+		printf("latency: p50 %u us, p90 %u us, p99 %u us, "
+		       "p99.9 %u us, max %u us\n", percentile(50),
+		       percentile(90), percentile(99), percentile(99.9),
+		       latencies[num_latencies - 1]);
+	}
+
+	report_files(tails);
+
+	for (i = 0; i < num_idents; ++i) {
+		if (tails[i].fd >= 0)
+			close(tails[i].fd);
+	}
+
+	free(latencies);
+	free(tails);
+	free(senders);
+	return EXIT_SUCCESS;
+}
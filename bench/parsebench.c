@@ -0,0 +1,492 @@
+/* SPDX-License-Identifier: ISC */
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#include "syslogd.h"
+
+/*
+  Expectations in the corpus are computed relative to this time, in UTC.
+  Fri Oct 16 12:00:00 UTC 2026
+ */
+#define CORPUS_NOW 1792152000
+
+/* minimum run time for each category in seconds */
+#define MIN_RUN_TIME 0.2
+
+#define MAX_CATEGORIES 32
+#define MAX_LINE 8192
+
+static const struct option long_opts[] = {
+	{ "help", no_argument, NULL, 'h' },
+	{ "generate", no_argument, NULL, 'g' },
+	{ "check", no_argument, NULL, 'c' },
+	{ "scanner", required_argument, NULL, 's' },
+	{ NULL, 0, NULL, 0 },
+};
+
+static const char *short_opts = "hgcs:";
+
+static const char *usage_string =
+"Usage: parsebench [OPTIONS..] <corpus>\n\n"
+"Check syslog_msg_parse() against the expected results in the corpus and\n"
+"measure its speed for each category of messages in the corpus.\n\n"
+"The following options are supported:\n"
+"  -h, --help      Print this help text and exit\n"
+"  -c, --check     Only check the results, don't measure anything.\n"
+"  -g, --generate  Print the corpus with the expected results replaced by\n"
+"                  what the parser currently produces.\n"
+"  -s, --scanner <name>\n"
+"                  Use this implementation of the string scanning\n"
+"                  functions: scalar, sse2 or avx2. Default is the best\n"
+"                  one available.\n\n"
+"Each corpus line consists of tab separated fields: a category name, the\n"
+"raw message and either 'error' or the expected message fields. Tabs,\n"
+"newlines, backslashes and other control characters are escaped C style.\n"
+"Empty lines and lines starting with '#' are ignored.\n";
+
+/* a sample without category is a comment or empty line of the corpus */
+typedef struct {
+	const char *category;
+
+	/* the raw message and its escaped form from the corpus */
+	char *input;
+	size_t len;
+	char *escaped;
+
+	/* expected result, escaped as in the corpus file */
+	char *expected;
+} sample_t;
+
+static sample_t *samples = NULL;
+static size_t num_samples = 0;
+static size_t max_samples = 0;
+
+static char *categories[MAX_CATEGORIES];
+static size_t num_categories = 0;
+
+static volatile int sink;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long cycles(void)
+{
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static int hexval(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* Decode a C style escaped string into out, returns the length. */
+static size_t unescape(char *out, const char *str)
+{
+	char *start = out;
+
+	while (*str != '\0') {
+		if (*str != '\\') {
+			*(out++) = *(str++);
+			continue;
+		}
+
+		switch (*(++str)) {
+		case 'n': *(out++) = '\n'; ++str; break;
+		case 't': *(out++) = '\t'; ++str; break;
+		case 'r': *(out++) = '\r'; ++str; break;
+		case '\\': *(out++) = '\\'; ++str; break;
+		case 'x':
+			if (hexval(str[1]) >= 0 && hexval(str[2]) >= 0) {
+				*(out++) = hexval(str[1]) << 4 | hexval(str[2]);
+				str += 3;
+				break;
+			}
+			/* fall-through */
+		default:
+			*(out++) = '\\';
+			break;
+		}
+	}
+
+	*out = '\0';
+	return out - start;
+}
+
+static char *escape(char *out, const char *str)
+{
+	static const char *hex = "0123456789abcdef";
+	unsigned char c;
+
+	while ((c = *(str++)) != '\0') {
+		switch (c) {
+		case '\n': *(out++) = '\\'; *(out++) = 'n'; break;
+		case '\t': *(out++) = '\\'; *(out++) = 't'; break;
+		case '\r': *(out++) = '\\'; *(out++) = 'r'; break;
+		case '\\': *(out++) = '\\'; *(out++) = '\\'; break;
+		default:
+			if (c < 0x20 || c >= 0x7f) {
+				*(out++) = '\\';
+				*(out++) = 'x';
+				*(out++) = hex[c >> 4];
+				*(out++) = hex[c & 0x0f];
+			} else {
+				*(out++) = c;
+			}
+			break;
+		}
+	}
+
+	*out = '\0';
+	return out;
+}
+
+/*
+  Format a parse result the way expectations are written in the corpus.
+  Optional fields are only present if set.
+ */
+static void format_result(char *out, const syslog_msg_t *msg, int ret)
+{
+	if (ret != 0) {
+		strcpy(out, "error");
+		return;
+	}
+
+	out += sprintf(out, "fac=%d\tlvl=%d\tts=%lld\tpid=%d", msg->facility,
+		       msg->level, (long long)msg->timestamp, (int)msg->pid);
+
+	if (msg->ident != NULL) {
+		out += sprintf(out, "\tident=");
+		out = escape(out, msg->ident);
+	}
+
+	if (msg->hostname != NULL) {
+		out += sprintf(out, "\thost=");
+		out = escape(out, msg->hostname);
+	}
+
+	if (msg->msgid != NULL) {
+		out += sprintf(out, "\tmsgid=");
+		out = escape(out, msg->msgid);
+	}
+
+	if (msg->sdata != NULL) {
+		out += sprintf(out, "\tsd=");
+		out = escape(out, msg->sdata);
+	}
+
+	out += sprintf(out, "\tmsg=");
+	escape(out, msg->message);
+}
+
+static const char *get_category(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < num_categories; ++i) {
+		if (strcmp(categories[i], name) == 0)
+			return categories[i];
+	}
+
+	if (num_categories == MAX_CATEGORIES)
+		return NULL;
+
+	categories[num_categories] = strdup(name);
+	return categories[num_categories++];
+}
+
+static int load_corpus(const char *path)
+{
+	char line[MAX_LINE], *input, *expected;
+	unsigned int lineno = 0;
+	sample_t *s;
+	size_t len;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		++lineno;
+		len = strlen(line);
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (num_samples == max_samples) {
+			max_samples = max_samples ? max_samples * 2 : 64;
+			s = realloc(samples, max_samples * sizeof(samples[0]));
+			if (s == NULL) {
+				perror("realloc");
+				goto fail;
+			}
+			samples = s;
+		}
+
+		s = samples + num_samples;
+		memset(s, 0, sizeof(*s));
+
+		if (line[0] == '\0' || line[0] == '#') {
+			s->escaped = strdup(line);
+			if (s->escaped == NULL) {
+				perror("strdup");
+				goto fail;
+			}
+			num_samples += 1;
+			continue;
+		}
+
+		input = strchr(line, '\t');
+		expected = input ? strchr(input + 1, '\t') : NULL;
+
+		if (expected == NULL) {
+			fprintf(stderr, "%s:%u: malformed line\n", path,
+				lineno);
+			goto fail;
+		}
+
+		*(input++) = '\0';
+		*(expected++) = '\0';
+
+		s->category = get_category(line);
+		s->escaped = strdup(input);
+		s->expected = strdup(expected);
+		s->input = malloc(strlen(input) + 1);
+
+		if (s->category == NULL || s->escaped == NULL ||
+		    s->expected == NULL || s->input == NULL) {
+			fprintf(stderr, "%s:%u: %s\n", path, lineno,
+				s->category == NULL ? "too many categories" :
+				strerror(errno));
+			goto fail;
+		}
+
+		s->len = unescape(s->input, input);
+		if (s->len >= SYSLOG_MSG_MAX) {
+			fprintf(stderr, "%s:%u: message too long\n", path,
+				lineno);
+			goto fail;
+		}
+
+		num_samples += 1;
+	}
+
+	fclose(fp);
+	return 0;
+fail:
+	fclose(fp);
+	return -1;
+}
+
+static int check(bool generate)
+{
+	char buffer[SYSLOG_MSG_MAX], result[4 * SYSLOG_MSG_MAX + 128];
+	unsigned int failed = 0, count = 0;
+	syslog_msg_t msg;
+	sample_t *s;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < num_samples; ++i) {
+		s = samples + i;
+
+		if (s->category == NULL) {
+			if (generate)
+				puts(s->escaped);
+			continue;
+		}
+
+		++count;
+
+		memcpy(buffer, s->input, s->len + 1);
+		ret = syslog_msg_parse(&msg, buffer);
+		format_result(result, &msg, ret);
+
+		if (generate) {
+			printf("%s\t%s\t%s\n", s->category, s->escaped,
+			       result);
+		} else if (strcmp(result, s->expected) != 0) {
+			printf("MISMATCH [%s] %s\n  expected: %s\n  got:      "
+			       "%s\n", s->category, s->escaped, s->expected,
+			       result);
+			++failed;
+		}
+	}
+
+	if (!generate) {
+		printf("corpus: %u messages, %u mismatches\n", count,
+		       failed);
+	}
+
+	return failed ? -1 : 0;
+}
+
+/* Run over all messages of a category once, optionally parsing them. */
+static size_t run_once(const char *category, bool parse)
+{
+	char buffer[SYSLOG_MSG_MAX];
+	syslog_msg_t msg;
+	size_t i, bytes = 0;
+	sample_t *s;
+
+	for (i = 0; i < num_samples; ++i) {
+		s = samples + i;
+		if (s->category == NULL ||
+		    (category != NULL && s->category != category)) {
+			continue;
+		}
+
+		memcpy(buffer, s->input, s->len + 1);
+		if (parse) {
+			sink += syslog_msg_parse(&msg, buffer);
+		} else {
+			sink += buffer[s->len / 2];
+		}
+		bytes += s->len;
+	}
+
+	return bytes;
+}
+
+static void measure(const char *category)
+{
+	double start, elapsed, base_elapsed, ns;
+	unsigned long long c0, c1, base_cycles;
+	size_t rounds = 0, count = 0, bytes = 0, i;
+
+	for (i = 0; i < num_samples; ++i) {
+		if (samples[i].category == NULL)
+			continue;
+		if (category == NULL || samples[i].category == category)
+			++count;
+	}
+
+	if (count == 0)
+		return;
+
+	/* time for copying the messages to a writable buffer */
+	start = now_sec();
+	c0 = cycles();
+	do {
+		run_once(category, false);
+		++rounds;
+		base_elapsed = now_sec() - start;
+	} while (base_elapsed < MIN_RUN_TIME / 4);
+	c1 = cycles();
+	base_cycles = (c1 - c0) / rounds;
+	base_elapsed /= rounds;
+
+	/* time for copying and parsing */
+	rounds = 0;
+	start = now_sec();
+	c0 = cycles();
+	do {
+		bytes = run_once(category, true);
+		++rounds;
+		elapsed = now_sec() - start;
+	} while (elapsed < MIN_RUN_TIME);
+	c1 = cycles();
+
+	elapsed = elapsed / rounds - base_elapsed;
+	ns = elapsed * 1e9 / count;
+
+	printf("  %-12s %6zu %8.1f %10.1f", category ? category : "all",
+	       count, (double)bytes / count, ns);
+
+#ifdef HAVE_RDTSC
+	printf(" %12.2f\n",
+	       ((double)(c1 - c0) / rounds - (double)base_cycles) / bytes);
+#else
+	(void)base_cycles;
+	printf(" %12s\n", "n/a");
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	bool generate = false, check_only = false;
+	size_t i;
+	int c;
+
+	for (;;) {
+		c = getopt_long(argc, argv, short_opts, long_opts, NULL);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'g':
+			generate = true;
+			break;
+		case 'c':
+			check_only = true;
+			break;
+		case 's':
+			if (scan_set_impl(optarg)) {
+				fprintf(stderr, "Scanner '%s' not available\n",
+					optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			fputs(usage_string, stdout);
+			return EXIT_SUCCESS;
+		default:
+			goto fail;
+		}
+	}
+
+	if (optind + 1 != argc)
+		goto fail;
+
+	setenv("TZ", "UTC", 1);
+	tzset();
+	syslog_clock_update(CORPUS_NOW);
+
+	if (load_corpus(argv[optind]))
+		return EXIT_FAILURE;
+
+	if (check(generate))
+		return EXIT_FAILURE;
+
+	if (generate || check_only)
+		return EXIT_SUCCESS;
+
+	printf("syslog_msg_parse (%s), excluding the copy to a writable "
+	       "buffer:\n", scan_impl());
+	printf("  %-12s %6s %8s %10s %12s\n", "category", "msgs", "bytes",
+	       "ns/msg", "cycles/byte");
+
+	for (i = 0; i < num_categories; ++i)
+		measure(categories[i]);
+
+	measure(NULL);
+	return EXIT_SUCCESS;
+fail:
+	fputs("Try `parsebench --help' for more information\n", stderr);
+	return EXIT_FAILURE;
+}
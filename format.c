@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: ISC */
+#include <string.h>
+#include <time.h>
+
+#include "syslogd.h"
+
+/* "[facility][level]" and "[level]" strings for every combination */
+static char fac_lvl_str[SYSLOG_NUM_FACILITIES][SYSLOG_NUM_LEVELS][24];
+static char lvl_str[SYSLOG_NUM_LEVELS][16];
+static size_t fac_lvl_len[SYSLOG_NUM_FACILITIES][SYSLOG_NUM_LEVELS];
+static size_t lvl_len[SYSLOG_NUM_LEVELS];
+static bool initialized = false;
+
+/* the most recently formatted time stamp */
+static time_t cached_time = -1;
+static char cached_str[32];
+static size_t cached_len;
+
+static size_t append(char *dst, const char *str)
+{
+	size_t len = strlen(str);
+
+	memcpy(dst, str, len);
+	return len;
+}
+
+static void format_init(void)
+{
+	size_t len;
+	int i, j;
+
+	for (j = 0; j < SYSLOG_NUM_LEVELS; ++j) {
+		len = 0;
+		lvl_str[j][len++] = '[';
+		len += append(lvl_str[j] + len, level_id_to_string(j));
+		lvl_str[j][len++] = ']';
+		lvl_len[j] = len;
+	}
+
+	for (i = 0; i < SYSLOG_NUM_FACILITIES; ++i) {
+		for (j = 0; j < SYSLOG_NUM_LEVELS; ++j) {
+			len = 0;
+			fac_lvl_str[i][j][len++] = '[';
+			len += append(fac_lvl_str[i][j] + len,
+				      facility_id_to_string(i));
+			fac_lvl_str[i][j][len++] = ']';
+			memcpy(fac_lvl_str[i][j] + len, lvl_str[j],
+			       lvl_len[j]);
+			fac_lvl_len[i][j] = len + lvl_len[j];
+		}
+	}
+
+	initialized = true;
+}
+
+size_t format_timestamp(char *out, time_t t)
+{
+	struct tm tm;
+
+	if (t != cached_time) {
+		gmtime_r(&t, &tm);
+		cached_len = strftime(cached_str, sizeof(cached_str),
+				      "%FT%T", &tm);
+		cached_time = t;
+	}
+
+	memcpy(out, cached_str, cached_len);
+	out[cached_len] = '\0';
+	return cached_len;
+}
+
+size_t format_prefix(char *out, const syslog_msg_t *msg, bool facility)
+{
+	char digits[16];
+	size_t len = 0;
+	pid_t pid;
+	int i = 0;
+
+	if (msg->facility < 0 || msg->facility >= SYSLOG_NUM_FACILITIES ||
+	    msg->level < 0 || msg->level >= SYSLOG_NUM_LEVELS) {
+		return 0;
+	}
+
+	if (!initialized)
+		format_init();
+
+	out[len++] = '[';
+	len += format_timestamp(out + len, msg->timestamp);
+	out[len++] = ']';
+
+	if (facility) {
+		memcpy(out + len, fac_lvl_str[msg->facility][msg->level],
+		       fac_lvl_len[msg->facility][msg->level]);
+		len += fac_lvl_len[msg->facility][msg->level];
+	} else {
+		memcpy(out + len, lvl_str[msg->level], lvl_len[msg->level]);
+		len += lvl_len[msg->level];
+	}
+
+	pid = msg->pid;
+	do {
+		digits[i++] = '0' + (unsigned int)pid % 10;
+		pid = (unsigned int)pid / 10;
+	} while (pid > 0);
+
+	out[len++] = '[';
+	while (i > 0)
+		out[len++] = digits[--i];
+	out[len++] = ']';
+	out[len++] = ' ';
+	out[len] = '\0';
+	return len;
+}
@@ -0,0 +1,833 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "syslogd.h"
+
+/* messages waiting to be sent, as octet counted frames */
+#define QUEUE_SIZE (256 * 1024)
+
+/* maximum size of a frame, longer messages are truncated */
+#define FRAME_MAX (SYSLOG_MSG_MAX + 512)
+
+/* room in front of a message for its length, see format_frame */
+#define FRAME_PREFIX 8
+
+/* maximum number of datagrams sent with a single system call */
+#define UDP_BATCH 64
+
+/* reconnect delay in milliseconds, doubled after every failure */
+#define BACKOFF_MIN 500
+#define BACKOFF_MAX 30000
+
+/* tick interval while the socket is not writable */
+#define POLL_INTERVAL 50
+
+/* the spool file is opened in the log directory */
+#define SPOOL_NAME "forward.spool"
+#define SPOOL_MAGIC "USLGSPL1"
+
+/* space freed at the start of the spool once this much was sent */
+#define SPOOL_PUNCH_SIZE (1024 * 1024)
+
+#define DEFAULT_PORT "514"
+
+typedef struct {
+	char magic[8];
+
+	/* offset of the first frame that has not been sent yet */
+	uint64_t sent;
+} spool_header_t;
+
+typedef struct {
+	log_backend_t base;
+
+	/* backend that gets every message as well, or NULL */
+	log_backend_t *local;
+
+	/* the collector, SOCK_DGRAM or SOCK_STREAM */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int type;
+	char *target;
+
+	/* HOSTNAME field for messages that don't have one */
+	char hostname[HOST_NAME_MAX + 1];
+
+	int fd;
+	bool connecting;
+	bool connected;
+
+	/* monotonic time in milliseconds of the next connection attempt */
+	long long retry_at;
+	unsigned int backoff;
+
+	/*
+	  Octet counted frames in queue[head, used). head is always at a
+	  frame boundary, with partial bytes of that frame already sent
+	  over the current TCP connection.
+	 */
+	char *queue;
+	size_t head;
+	size_t used;
+	size_t partial;
+
+	/*
+	  Frames that did not fit into the queue, in the same format and
+	  with a spool_header_t in front. While the spool has unsent data,
+	  all new messages are appended to it and the queue only holds
+	  frames read back from it, so the order is preserved. Frames from
+	  spool_sent up to spool_read are in the queue.
+	 */
+	int spool_fd;
+	size_t spool_max;
+	uint64_t spool_sent;
+	uint64_t spool_read;
+	uint64_t spool_end;
+	uint64_t spool_punched;
+
+	/* messages and bytes sent, for statistics */
+	uint64_t messages;
+	uint64_t bytes;
+} log_backend_forward_t;
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000L;
+}
+
+/*
+  Parse the length of a frame at the start of a buffer. Returns the
+  total size of the frame and the size of the octet count including the
+  space, 0 if it is incomplete or -1 if the data is not a valid frame.
+ */
+static ssize_t frame_size(const char *data, size_t avail, size_t *hdrlen)
+{
+	size_t i, len = 0;
+
+	for (i = 0; i < avail && i < FRAME_PREFIX; ++i) {
+		if (data[i] == ' ') {
+			if (i == 0 || len > FRAME_MAX)
+				return -1;
+			*hdrlen = i + 1;
+			return (i + 1 + len <= avail) ? (ssize_t)(i + 1 + len) : 0;
+		}
+
+		if (data[i] < '0' || data[i] > '9')
+			return -1;
+
+		len = len * 10 + (data[i] - '0');
+	}
+
+	return i < FRAME_PREFIX ? 0 : -1;
+}
+
+/*
+  Format a message as RFC 5424 with an RFC 6587 octet count in front.
+  The frame is written to buffer + FRAME_PREFIX, and the octet count in
+  front of that. Returns a pointer to the start of the frame.
+ */
+static char *format_frame(log_backend_forward_t *log, char *buffer,
+			  const syslog_msg_t *msg, size_t *size)
+{
+	char *out = buffer + FRAME_PREFIX, digits[FRAME_PREFIX], ts[32];
+	char procid[16];
+	size_t len;
+	int ret;
+
+	format_timestamp(ts, msg->timestamp);
+
+	if (msg->pid > 0) {
+		snprintf(procid, sizeof(procid), "%d", (int)msg->pid);
+	} else {
+		strcpy(procid, "-");
+	}
+
+	ret = snprintf(out, FRAME_MAX, "<%d>1 %sZ %s %.48s %s %.32s %s%s%s",
+		       msg->facility * 8 + msg->level, ts,
+		       msg->hostname != NULL ? msg->hostname : log->hostname,
+		       msg->ident != NULL ? msg->ident : "-", procid,
+		       msg->msgid != NULL ? msg->msgid : "-",
+		       msg->sdata != NULL ? msg->sdata : "-",
+		       msg->message[0] != '\0' ? " " : "", msg->message);
+
+	len = (ret < 0) ? 0 : ((size_t)ret >= FRAME_MAX ? FRAME_MAX - 1 : ret);
+
+	ret = snprintf(digits, sizeof(digits), "%zu ", len);
+	memcpy(out - ret, digits, ret);
+
+	*size = ret + len;
+	return out - ret;
+}
+
+/*****************************************************************************/
+
+static void spool_update_stats(const log_backend_forward_t *log)
+{
+	__atomic_store_n(&stats.forward_spool_bytes,
+			 log->spool_end - log->spool_sent, __ATOMIC_RELAXED);
+}
+
+static int spool_write_header(log_backend_forward_t *log)
+{
+	spool_header_t hdr;
+
+	memcpy(hdr.magic, SPOOL_MAGIC, sizeof(hdr.magic));
+	hdr.sent = log->spool_sent;
+
+	if (pwrite(log->spool_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+		perror(SPOOL_NAME);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void spool_reset(log_backend_forward_t *log)
+{
+	log->spool_sent = sizeof(spool_header_t);
+	log->spool_read = log->spool_sent;
+	log->spool_end = log->spool_sent;
+	log->spool_punched = log->spool_sent;
+
+	if (ftruncate(log->spool_fd, 0))
+		perror(SPOOL_NAME);
+
+	spool_write_header(log);
+	spool_update_stats(log);
+}
+
+/* Continue with frames left over from the last run, if there are any. */
+static int spool_open(log_backend_forward_t *log)
+{
+	spool_header_t hdr;
+	struct stat sb;
+
+	log->spool_fd = open(SPOOL_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+	if (log->spool_fd < 0 || fstat(log->spool_fd, &sb)) {
+		perror(SPOOL_NAME);
+		return -1;
+	}
+
+	if ((size_t)sb.st_size < sizeof(hdr) ||
+	    pread(log->spool_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, SPOOL_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    hdr.sent < sizeof(hdr) || hdr.sent > (uint64_t)sb.st_size) {
+		spool_reset(log);
+		return 0;
+	}
+
+	log->spool_sent = hdr.sent;
+	log->spool_read = hdr.sent;
+	log->spool_end = sb.st_size;
+	log->spool_punched = hdr.sent;
+
+	if (log->spool_sent == log->spool_end) {
+		spool_reset(log);
+	} else {
+		spool_update_stats(log);
+	}
+	return 0;
+}
+
+static bool spooling(const log_backend_forward_t *log)
+{
+	return log->spool_end > log->spool_sent;
+}
+
+static int spool_append(log_backend_forward_t *log, const char *data,
+			size_t size)
+{
+	ssize_t ret;
+
+	if (log->spool_fd < 0)
+		return -1;
+
+	ret = pwrite(log->spool_fd, data, size, log->spool_end);
+	if (ret < 0 || (size_t)ret != size) {
+		if (ret < 0)
+			perror(SPOOL_NAME);
+		return -1;
+	}
+
+	log->spool_end += size;
+	spool_update_stats(log);
+	return 0;
+}
+
+/* Read frames back from the spool into the free space of the queue. */
+static void spool_fill(log_backend_forward_t *log)
+{
+	size_t count;
+	ssize_t ret;
+
+	/* make room, also for a frame that was only read in part */
+	if (log->head > 0 && (log->head >= QUEUE_SIZE / 2 ||
+			      log->used - log->head < FRAME_PREFIX + FRAME_MAX)) {
+		memmove(log->queue, log->queue + log->head,
+			log->used - log->head);
+		log->used -= log->head;
+		log->head = 0;
+	}
+
+	count = QUEUE_SIZE - log->used;
+	if (count > log->spool_end - log->spool_read)
+		count = log->spool_end - log->spool_read;
+
+	if (count == 0)
+		return;
+
+	ret = pread(log->spool_fd, log->queue + log->used, count,
+		    log->spool_read);
+	if (ret <= 0) {
+		if (ret < 0)
+			perror(SPOOL_NAME);
+		return;
+	}
+
+	log->used += ret;
+	log->spool_read += ret;
+}
+
+/* Record that the given number of bytes from the spool has been sent. */
+static void spool_consumed(log_backend_forward_t *log, size_t size)
+{
+	log->spool_sent += size;
+
+	if (log->spool_sent == log->spool_end) {
+		spool_reset(log);
+		return;
+	}
+
+	spool_write_header(log);
+	spool_update_stats(log);
+
+	/* the file only shrinks once it is empty, free the sent part */
+	if (log->spool_sent - log->spool_punched >= SPOOL_PUNCH_SIZE) {
+		if (fallocate(log->spool_fd,
+			      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			      log->spool_punched,
+			      log->spool_sent - log->spool_punched) == 0) {
+			log->spool_punched = log->spool_sent;
+		}
+	}
+}
+
+/*
+  Move the queue to the spool, so that messages that follow can be
+  appended to it without getting ahead of the queued ones.
+ */
+static int spool_start(log_backend_forward_t *log)
+{
+	if (spool_append(log, log->queue + log->head, log->used - log->head))
+		return -1;
+
+	log->spool_read = log->spool_end;
+	return 0;
+}
+
+/*****************************************************************************/
+
+static void forward_disconnect(log_backend_forward_t *log, int err)
+{
+	if (err != 0) {
+		fprintf(stderr, "forwarding to %s: %s, retrying in %u ms\n",
+			log->target, strerror(err), log->backoff);
+		STATS_ADD(stats.forward_errors, 1);
+	}
+
+	if (log->fd >= 0) {
+		close(log->fd);
+		log->fd = -1;
+	}
+
+	log->connecting = false;
+	log->connected = false;
+	log->retry_at = now_ms() + log->backoff;
+
+	log->backoff *= 2;
+	if (log->backoff > BACKOFF_MAX)
+		log->backoff = BACKOFF_MAX;
+
+	/* a frame that was cut off is sent again in full */
+	log->partial = 0;
+
+	/* frames read from the spool are read again on the next attempt */
+	if (spooling(log)) {
+		log->head = 0;
+		log->used = 0;
+		log->spool_read = log->spool_sent;
+	}
+}
+
+static void forward_connect(log_backend_forward_t *log)
+{
+	log->fd = socket(log->addr.ss_family,
+			 log->type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (log->fd < 0) {
+		forward_disconnect(log, errno);
+		return;
+	}
+
+	if (connect(log->fd, (struct sockaddr *)&log->addr, log->addrlen)) {
+		if (errno == EINPROGRESS) {
+			log->connecting = true;
+		} else {
+			forward_disconnect(log, errno);
+		}
+		return;
+	}
+
+	log->connected = true;
+}
+
+/* Check whether a non-blocking TCP connect has completed. */
+static void forward_check_connect(log_backend_forward_t *log)
+{
+	struct pollfd pfd;
+	socklen_t len;
+	int err = 0;
+
+	pfd.fd = log->fd;
+	pfd.events = POLLOUT;
+
+	if (poll(&pfd, 1, 0) <= 0)
+		return;
+
+	len = sizeof(err);
+	if (getsockopt(log->fd, SOL_SOCKET, SO_ERROR, &err, &len))
+		err = errno;
+
+	if (err != 0) {
+		forward_disconnect(log, err);
+		return;
+	}
+
+	log->connecting = false;
+	log->connected = true;
+}
+
+/* Remove sent frames from the queue. */
+static void forward_consumed(log_backend_forward_t *log, size_t size,
+			     size_t count)
+{
+	log->head += size;
+	log->messages += count;
+	log->bytes += size;
+	log->backoff = BACKOFF_MIN;
+
+	if (log->head == log->used)
+		log->head = log->used = 0;
+
+	if (spooling(log))
+		spool_consumed(log, size);
+}
+
+/*
+  Send as many complete frames as the socket takes. Returns 0 if it
+  would block or everything was sent, -1 if the connection was lost.
+ */
+static int forward_send(log_backend_forward_t *log)
+{
+	struct mmsghdr hdr[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	size_t sizes[UDP_BATCH];
+	size_t offset, count, size, skip;
+	struct pollfd pfd;
+	ssize_t frame, ret;
+
+	/*
+	  Data sent after the collector closed the connection would be
+	  lost without an error, so check for that first. The collector
+	  never sends anything.
+	 */
+	if (log->type == SOCK_STREAM) {
+		pfd.fd = log->fd;
+		pfd.events = POLLRDHUP;
+
+		if (poll(&pfd, 1, 0) > 0 &&
+		    (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR))) {
+			forward_disconnect(log, ECONNRESET);
+			return -1;
+		}
+	}
+
+	for (;;) {
+		if (spooling(log))
+			spool_fill(log);
+
+		/* collect complete frames */
+		offset = log->head;
+		count = 0;
+
+		while (log->type == SOCK_STREAM || count < UDP_BATCH) {
+			frame = frame_size(log->queue + offset,
+					   log->used - offset, &skip);
+			if (frame == 0)
+				break;
+
+			if (frame < 0) {
+				fprintf(stderr, "forwarding to %s: corrupted "
+					"spool, discarding it\n", log->target);
+				log->head = log->used = 0;
+				log->partial = 0;
+				spool_reset(log);
+				return 0;
+			}
+
+			/* datagrams are not octet counted */
+			if (log->type == SOCK_DGRAM) {
+				sizes[count] = frame;
+				iov[count].iov_base = log->queue + offset + skip;
+				iov[count].iov_len = frame - skip;
+				memset(&hdr[count], 0, sizeof(hdr[count]));
+				hdr[count].msg_hdr.msg_iov = iov + count;
+				hdr[count].msg_hdr.msg_iovlen = 1;
+			}
+
+			offset += frame;
+			count += 1;
+		}
+
+		if (count == 0)
+			return 0;
+
+		if (log->type == SOCK_DGRAM) {
+			ret = sendmmsg(log->fd, hdr, count, MSG_DONTWAIT);
+			if (ret <= 0)
+				goto fail;
+
+			size = 0;
+			for (count = 0; count < (size_t)ret; ++count)
+				size += sizes[count];
+
+			forward_consumed(log, size, ret);
+			continue;
+		}
+
+		ret = send(log->fd, log->queue + log->head + log->partial,
+			   offset - log->head - log->partial,
+			   MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret <= 0)
+			goto fail;
+
+		log->partial += ret;
+
+		/* only remove frames that went out completely */
+		size = 0;
+		count = 0;
+		while ((frame = frame_size(log->queue + log->head + size,
+					   log->used - log->head - size,
+					   &skip)) > 0 &&
+		       size + frame <= log->partial) {
+			size += frame;
+			count += 1;
+		}
+
+		log->partial -= size;
+		if (size > 0)
+			forward_consumed(log, size, count);
+	}
+fail:
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+
+	forward_disconnect(log, ret < 0 ? errno : ECONNRESET);
+	return -1;
+}
+
+static bool forward_pending(const log_backend_forward_t *log)
+{
+	return log->used > log->head || spooling(log);
+}
+
+/*****************************************************************************/
+
+/* Parse "udp://host[:port]" or "tcp://host[:port]", IPv6 in brackets. */
+static int forward_resolve(log_backend_forward_t *log, const char *target)
+{
+	struct addrinfo hints, *res;
+	char *host, *port, *end;
+	int ret;
+
+	memset(&hints, 0, sizeof(hints));
+
+	if (strncmp(target, "udp://", 6) == 0) {
+		hints.ai_socktype = SOCK_DGRAM;
+	} else if (strncmp(target, "tcp://", 6) == 0) {
+		hints.ai_socktype = SOCK_STREAM;
+	} else {
+		fprintf(stderr, "%s: expected udp:// or tcp:// address\n",
+			target);
+		return -1;
+	}
+
+	host = strdup(target + 6);
+	if (host == NULL) {
+		perror("strdup");
+		return -1;
+	}
+
+	if (host[0] == '[' && (end = strchr(host, ']')) != NULL) {
+		*(end++) = '\0';
+		port = *end == ':' ? end + 1 : NULL;
+		memmove(host, host + 1, strlen(host));
+	} else if ((port = strrchr(host, ':')) != NULL) {
+		*(port++) = '\0';
+	}
+
+	ret = getaddrinfo(host, (port != NULL && *port != '\0') ?
+			  port : DEFAULT_PORT, &hints, &res);
+	if (ret != 0) {
+		fprintf(stderr, "%s: %s\n", target, gai_strerror(ret));
+		free(host);
+		return -1;
+	}
+
+	memcpy(&log->addr, res->ai_addr, res->ai_addrlen);
+	log->addrlen = res->ai_addrlen;
+	log->type = hints.ai_socktype;
+
+	freeaddrinfo(res);
+	free(host);
+	return 0;
+}
+
+static int forward_backend_init(log_backend_t *backend,
+				const log_config_t *cfg)
+{
+	log_backend_forward_t *log = (log_backend_forward_t *)backend;
+
+	if (cfg->forward_to == NULL) {
+		fputs("No address to forward messages to, "
+		      "see --forward\n", stderr);
+		return -1;
+	}
+
+	log->fd = -1;
+	log->spool_fd = -1;
+	log->spool_max = cfg->spool_size;
+	log->backoff = BACKOFF_MIN;
+
+	if (gethostname(log->hostname, sizeof(log->hostname) - 1) ||
+	    log->hostname[0] == '\0') {
+		strcpy(log->hostname, "-");
+	}
+
+	log->target = strdup(cfg->forward_to);
+	if (log->target == NULL) {
+		perror("strdup");
+		return -1;
+	}
+
+	if (forward_resolve(log, log->target))
+		goto fail;
+
+	log->queue = malloc(QUEUE_SIZE);
+	if (log->queue == NULL) {
+		perror("malloc");
+		goto fail;
+	}
+
+	if (log->spool_max > 0 && spool_open(log))
+		goto fail;
+
+	if (log->local != NULL && log->local->init(log->local, cfg))
+		goto fail;
+
+	return 0;
+fail:
+	if (log->spool_fd >= 0)
+		close(log->spool_fd);
+	log->spool_fd = -1;
+	free(log->queue);
+	log->queue = NULL;
+	free(log->target);
+	log->target = NULL;
+	return -1;
+}
+
+/*
+  Send what can be sent without waiting. Whatever is left in the queue
+  is saved to the spool, so it is sent after the next start.
+ */
+static void forward_backend_cleanup(log_backend_t *backend)
+{
+	log_backend_forward_t *log = (log_backend_forward_t *)backend;
+	size_t lost = 0;
+
+	if (log->connected)
+		forward_send(log);
+
+	if (!spooling(log) && log->used > log->head &&
+	    spool_start(log) != 0) {
+		lost = log->used - log->head;
+	}
+
+	if (lost > 0) {
+		fprintf(stderr, "forwarding to %s: %zu bytes of messages "
+			"not sent\n", log->target, lost);
+	}
+
+	if (log->fd >= 0)
+		close(log->fd);
+	if (log->spool_fd >= 0)
+		close(log->spool_fd);
+
+	log->fd = -1;
+	log->spool_fd = -1;
+	log->connected = false;
+	log->connecting = false;
+	log->head = log->used = log->partial = 0;
+
+	free(log->queue);
+	free(log->target);
+	log->queue = NULL;
+	log->target = NULL;
+
+	if (log->local != NULL)
+		log->local->cleanup(log->local);
+}
+
+static int forward_backend_write(log_backend_t *backend,
+				 const syslog_msg_t *msg)
+{
+	log_backend_forward_t *log = (log_backend_forward_t *)backend;
+	char buffer[FRAME_PREFIX + FRAME_MAX];
+	int ret = 0;
+	size_t size;
+	char *frame;
+
+	if (log->local != NULL)
+		ret = log->local->write(log->local, msg);
+
+	if (msg->facility < 0 || msg->facility >= SYSLOG_NUM_FACILITIES ||
+	    msg->level < 0 || msg->level >= SYSLOG_NUM_LEVELS) {
+		return -1;
+	}
+
+	frame = format_frame(log, buffer, msg, &size);
+
+	if (!spooling(log)) {
+		if (size > QUEUE_SIZE - log->used && log->head > 0) {
+			memmove(log->queue, log->queue + log->head,
+				log->used - log->head);
+			log->used -= log->head;
+			log->head = 0;
+		}
+
+		if (size <= QUEUE_SIZE - log->used) {
+			memcpy(log->queue + log->used, frame, size);
+			log->used += size;
+			return ret;
+		}
+
+		if (spool_start(log) != 0)
+			goto drop;
+	}
+
+	/* frames that are also in the queue do not count towards the limit */
+	if (log->spool_end - log->spool_read + size > log->spool_max ||
+	    spool_append(log, frame, size) != 0) {
+		goto drop;
+	}
+
+	STATS_ADD(stats.forward_spooled, 1);
+	return ret;
+drop:
+	STATS_ADD(stats.forward_dropped, 1);
+	return -1;
+}
+
+static void forward_backend_rotate(log_backend_t *backend)
+{
+	log_backend_forward_t *log = (log_backend_forward_t *)backend;
+
+	if (log->local != NULL)
+		log->local->rotate(log->local);
+}
+
+static int forward_backend_tick(log_backend_t *backend)
+{
+	log_backend_forward_t *log = (log_backend_forward_t *)backend;
+	int timeout = -1, ret = -1;
+	long long now;
+
+	if (log->local != NULL)
+		ret = log->local->tick(log->local);
+
+	if (forward_pending(log)) {
+		now = now_ms();
+
+		if (!log->connected && !log->connecting &&
+		    now >= log->retry_at) {
+			forward_connect(log);
+		}
+
+		if (log->connecting)
+			forward_check_connect(log);
+
+		if (log->connected)
+			forward_send(log);
+	}
+
+	if (forward_pending(log)) {
+		if (log->connected || log->connecting) {
+			timeout = POLL_INTERVAL;
+		} else {
+			now = now_ms();
+			timeout = log->retry_at > now ? log->retry_at - now : 0;
+		}
+	}
+
+	if (ret >= 0 && (timeout < 0 || ret < timeout))
+		timeout = ret;
+
+	return timeout;
+}
+
+static void forward_backend_stream_stats(log_backend_t *backend,
+					 log_stream_fn fn, void *user)
+{
+	log_backend_forward_t *log = (log_backend_forward_t *)backend;
+
+	fn(user, "forward", 7, log->messages, log->bytes);
+
+	if (log->local != NULL && log->local->stream_stats != NULL)
+		log->local->stream_stats(log->local, fn, user);
+}
+
+static log_backend_forward_t fwdbackend = {
+	.base = {
+		.init = forward_backend_init,
+		.cleanup = forward_backend_cleanup,
+		.write = forward_backend_write,
+		.rotate = forward_backend_rotate,
+		.tick = forward_backend_tick,
+		.stream_stats = forward_backend_stream_stats,
+	},
+	.fd = -1,
+	.spool_fd = -1,
+};
+
+log_backend_t *forward_backend = (log_backend_t *)&fwdbackend;
+
+log_backend_t *forward_backend_tee(log_backend_t *local)
+{
+	fwdbackend.local = local;
+	return forward_backend;
+}
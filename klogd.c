@@ -1,12 +1,21 @@
 /* SPDX-License-Identifier: ISC */
+#include <sys/socket.h>
 #include <sys/klog.h>
+#include <sys/un.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
 #include <syslog.h>
 #include <signal.h>
 #include <string.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 
 #include "config.h"
 
@@ -19,18 +28,48 @@ enum {
 	KLOG_CONSOLE_LEVEL = 8,
 };
 
+#define KMSG_PATH "/dev/kmsg"
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+#define DEFAULT_SOCKET "/dev/log"
+
+/* a single /dev/kmsg record is limited to about 1 KiB of text */
+#define KMSG_RECORD_MAX 8192
+
+/* messages that can be held back while syslogd is busy or not running */
+#define SEND_QUEUE_SIZE 128
+
+/* maximum size of a formatted message, longer ones are truncated */
+#define SEND_MSG_MAX 2048
+
+/* milliseconds to wait before trying again if syslogd is not there */
+#define RETRY_INTERVAL 1000
+
+/* structured data ID for the kernel sequence number */
+#define KMSG_SD_ID "kmsg@32473"
+
 static char log_buffer[4096];
 static sig_atomic_t running = 1;
 static int level = 0;
+static const char *socket_path = DEFAULT_SOCKET;
+static const char *cursor_path = NULL;
+static bool use_klogctl = false;
+
+/* state of the /dev/kmsg reader */
+static int log_fd = -1;
+static char boot_id[40];
+static long long boot_time_us;
 
 static const struct option options[] = {
 	{ "help", no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'V' },
 	{ "level", required_argument, NULL, 'l' },
+	{ "socket", required_argument, NULL, 'S' },
+	{ "cursor", required_argument, NULL, 'c' },
+	{ "klogctl", no_argument, NULL, 'k' },
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *shortopt = "hVl:";
+static const char *shortopt = "hVl:S:c:k";
 
 static const char *helptext =
 "Usage: klogd [OPTION]... \n\n"
@@ -39,6 +78,15 @@ static const char *helptext =
 "The following OPTIONSs can be used:\n"
 "  -l, --level <level>  Minimum log level that should be printed to console.\n"
 "                       If not set, logging to console is turned off.\n"
+"  -S, --socket <path>  Send messages to this socket instead of\n"
+"                       " DEFAULT_SOCKET "\n"
+"  -c, --cursor <file>  Remember the sequence number of the last forwarded\n"
+"                       message in this file and on restart, continue after\n"
+"                       it instead of forwarding the whole kernel log again.\n"
+"  -k, --klogctl        Read messages through klogctl() instead of\n"
+"                       " KMSG_PATH ". This is done anyway if the latter is\n"
+"                       not available. Kernel time stamps and sequence\n"
+"                       numbers are not preserved in this mode.\n"
 "  -h, --help           Print this help text and exit\n"
 "  -V, --version        Print version information and exit\n\n";
 
@@ -61,6 +109,15 @@ static void process_options(int argc, char **argv)
 		case 'l':
 			level = strtoul(optarg, NULL, 10);
 			break;
+		case 'S':
+			socket_path = optarg;
+			break;
+		case 'c':
+			cursor_path = optarg;
+			break;
+		case 'k':
+			use_klogctl = true;
+			break;
 		case 'h':
 			fputs(helptext, stdout);
 			exit(EXIT_SUCCESS);
@@ -97,45 +154,485 @@ static void sigsetup(void)
 	sigprocmask(SIG_SETMASK, &mask, NULL);
 }
 
-static void log_open(void)
+/*****************************************************************************/
+
+typedef struct {
+	int priority;
+	unsigned long long seq;
+	unsigned long long ts_us;
+	const char *text;
+	size_t len;
+} kmsg_record_t;
+
+/*
+  A record looks like "<priority>,<sequence>,<microseconds>,<flags>[,...];"
+  followed by the message and a line break. Continuation lines with
+  key/value pairs follow and are ignored.
+ */
+static int kmsg_parse(char *str, size_t len, kmsg_record_t *rec)
 {
-	klogctl(KLOG_OPEN, NULL, 0);
+	char *end, *text;
 
-	if (level) {
-		klogctl(KLOG_CONSOLE_LEVEL, NULL, level);
-	} else {
-		klogctl(KLOG_CONSOLE_OFF, NULL, 0);
+	str[len] = '\0';
+
+	text = strchr(str, ';');
+	if (text == NULL)
+		return -1;
+	*(text++) = '\0';
+
+	rec->priority = strtol(str, &end, 10);
+	if (end == str || *end != ',')
+		return -1;
+
+	str = end + 1;
+	rec->seq = strtoull(str, &end, 10);
+	if (end == str || *end != ',')
+		return -1;
+
+	str = end + 1;
+	rec->ts_us = strtoull(str, &end, 10);
+	if (end == str || *end != ',')
+		return -1;
+
+	rec->text = text;
+	rec->len = strcspn(text, "\n");
+	return 0;
+}
+
+/*
+  Format a record as an RFC 5424 message. The time stamp is derived from
+  the kernel time stamp, which is also kept at the start of the message,
+  like dmesg shows it. The sequence number goes into structured data.
+ */
+static size_t kmsg_format(char *out, size_t size, const kmsg_record_t *rec)
+{
+	long long us = boot_time_us + (long long)rec->ts_us;
+	time_t sec = us / 1000000LL;
+	char timestamp[32];
+	struct tm tm;
+	int ret;
+
+	gmtime_r(&sec, &tm);
+	strftime(timestamp, sizeof(timestamp), "%FT%T", &tm);
+
+	ret = snprintf(out, size, "<%d>1 %s.%06lldZ - kernel - - "
+		       "[" KMSG_SD_ID " seq=\"%llu\"] [%5llu.%06llu] %.*s",
+		       rec->priority, timestamp, us % 1000000LL, rec->seq,
+		       rec->ts_us / 1000000ULL, rec->ts_us % 1000000ULL,
+		       (int)rec->len, rec->text);
+
+	if (ret < 0)
+		return 0;
+
+	return (size_t)ret >= size ? size - 1 : (size_t)ret;
+}
+
+static int log_connect(void)
+{
+	struct sockaddr_un un;
+
+	if (log_fd >= 0)
+		return 0;
+
+	log_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (log_fd < 0)
+		return -1;
+
+	memset(&un, 0, sizeof(un));
+	un.sun_family = AF_UNIX;
+	strncpy(un.sun_path, socket_path, sizeof(un.sun_path) - 1);
+
+	if (connect(log_fd, (struct sockaddr *)&un, sizeof(un))) {
+		close(log_fd);
+		log_fd = -1;
+		return -1;
 	}
 
-	openlog("kernel", 0, LOG_KERN);
+	return 0;
 }
 
-static void log_close(void)
+static void log_disconnect(void)
 {
-	klogctl(KLOG_CONSOLE_ON, NULL, 0);
-	klogctl(KLOG_CLOSE, NULL, 0);
-	syslog(LOG_NOTICE, "-- klogd terminating --");
+	close(log_fd);
+	log_fd = -1;
 }
 
-int main(int argc, char **argv)
+/*
+  Messages are formatted directly into a ring of fixed size slots and sent
+  to syslogd with sendmmsg(). If the socket of syslogd is full, or syslogd
+  is not running at all, they stay in the queue until they can be sent.
+  Each slot remembers the kernel sequence number of its record, so the
+  cursor only ever covers records that were actually delivered.
+ */
+static struct {
+	char data[SEND_QUEUE_SIZE][SEND_MSG_MAX];
+	struct iovec iov[SEND_QUEUE_SIZE];
+	struct mmsghdr hdr[SEND_QUEUE_SIZE];
+	unsigned long long seq[SEND_QUEUE_SIZE];
+	size_t head, count;
+
+	/* sequence number of the last delivered record, 0 if none */
+	unsigned long long sent_seq;
+} queue;
+
+static void queue_init(void)
 {
-	int diff, count = 0, priority, ret = EXIT_SUCCESS;
-	char *ptr, *end;
+	size_t i;
 
-	process_options(argc, argv);
-	sigsetup();
-	log_open();
+	for (i = 0; i < SEND_QUEUE_SIZE; ++i) {
+		queue.iov[i].iov_base = queue.data[i];
+		queue.hdr[i].msg_hdr.msg_iov = queue.iov + i;
+		queue.hdr[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+static bool queue_full(void)
+{
+	return queue.count == SEND_QUEUE_SIZE;
+}
+
+/* A record and a notice about records missed before it always fit. */
+static bool queue_has_room(void)
+{
+	return queue.count + 1 < SEND_QUEUE_SIZE;
+}
+
+static char *queue_tail(void)
+{
+	return queue.data[(queue.head + queue.count) % SEND_QUEUE_SIZE];
+}
+
+/* Add the message formatted into queue_tail(). A seq of 0 means none. */
+static void queue_commit(size_t len, unsigned long long seq)
+{
+	size_t idx = (queue.head + queue.count) % SEND_QUEUE_SIZE;
+
+	queue.iov[idx].iov_len = len;
+	queue.seq[idx] = seq;
+	queue.count += 1;
+}
+
+static void queue_pop(size_t count)
+{
+	size_t idx;
+
+	while (count--) {
+		idx = queue.head;
+
+		if (queue.seq[idx] != 0)
+			queue.sent_seq = queue.seq[idx];
+
+		queue.head = (queue.head + 1) % SEND_QUEUE_SIZE;
+		queue.count -= 1;
+	}
+}
+
+/*
+  Send as much of the queue as possible without blocking. Returns -1 if
+  syslogd is not reachable and sending should be retried later.
+ */
+static int queue_flush(void)
+{
+	size_t count;
+	int ret;
+
+	while (queue.count > 0) {
+		if (log_connect())
+			return -1;
+
+		count = SEND_QUEUE_SIZE - queue.head;
+		if (count > queue.count)
+			count = queue.count;
+
+		ret = sendmmsg(log_fd, queue.hdr + queue.head, count,
+			       MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 0;
+
+			/* retrying would not fix these */
+			if (errno == EMSGSIZE || errno == EINVAL) {
+				fprintf(stderr, "klogd: dropping message: %s\n",
+					strerror(errno));
+				queue_pop(1);
+				continue;
+			}
+
+			log_disconnect();
+			return -1;
+		}
+
+		queue_pop(ret);
+	}
+
+	return 0;
+}
+
+/*
+  Wait until there is room in the queue (or it is empty, if all is set),
+  or until klogd is told to terminate.
+ */
+static void queue_wait(bool all)
+{
+	struct pollfd pfd;
+
+	while (running) {
+		if (queue.count == 0 || (!all && !queue_full()))
+			break;
+
+		if (queue_flush() == 0 &&
+		    (queue.count == 0 || (!all && !queue_full()))) {
+			break;
+		}
+
+		pfd.fd = log_fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+
+		poll(&pfd, log_fd < 0 ? 0 : 1,
+		     log_fd < 0 ? RETRY_INTERVAL : -1);
+	}
+}
+
+static int log_notice(int priority, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/*
+  Queue a message about klogd itself. If the queue is full, it goes to
+  stderr instead, so it is never lost silently.
+ */
+static int log_notice(int priority, const char *fmt, ...)
+{
+	char *buffer;
+	va_list ap;
+	int ret;
+
+	if (queue_full())
+		queue_flush();
+
+	if (queue_full()) {
+		fputs("klogd: ", stderr);
+		va_start(ap, fmt);
+		vfprintf(stderr, fmt, ap);
+		va_end(ap);
+		fputc('\n', stderr);
+		return -1;
+	}
+
+	buffer = queue_tail();
+	ret = snprintf(buffer, SEND_MSG_MAX, "<%d>klogd: ", priority);
+
+	va_start(ap, fmt);
+	vsnprintf(buffer + ret, SEND_MSG_MAX - ret, fmt, ap);
+	va_end(ap);
+
+	queue_commit(strlen(buffer), 0);
+	return 0;
+}
+
+/*****************************************************************************/
+
+static int read_boot_id(void)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = open(BOOT_ID_PATH, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	ret = read(fd, boot_id, sizeof(boot_id) - 1);
+	close(fd);
+
+	if (ret <= 0)
+		return -1;
+
+	boot_id[ret] = '\0';
+	boot_id[strcspn(boot_id, "\n")] = '\0';
+	return 0;
+}
+
+/*
+  The cursor file contains the boot ID and the sequence number of the last
+  forwarded record. Sequence numbers start over on every boot, so the
+  cursor only applies if the boot ID matches.
+ */
+static bool cursor_load(unsigned long long *seq)
+{
+	char id[sizeof(boot_id)];
+	bool found = false;
+	FILE *fp;
+
+	if (cursor_path == NULL || boot_id[0] == '\0')
+		return false;
+
+	fp = fopen(cursor_path, "r");
+	if (fp == NULL) {
+		if (errno != ENOENT)
+			perror(cursor_path);
+		return false;
+	}
+
+	if (fscanf(fp, "%39s %llu", id, seq) == 2)
+		found = strcmp(id, boot_id) == 0;
+
+	fclose(fp);
+	return found;
+}
+
+static void cursor_save(unsigned long long seq)
+{
+	char *tmp;
+	FILE *fp;
+
+	if (cursor_path == NULL)
+		return;
+
+	tmp = alloca(strlen(cursor_path) + 5);
+	sprintf(tmp, "%s.tmp", cursor_path);
+
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		perror(tmp);
+		return;
+	}
+
+	fprintf(fp, "%s %llu\n", boot_id, seq);
+
+	if (fclose(fp) != 0) {
+		perror(tmp);
+		unlink(tmp);
+		return;
+	}
+
+	if (rename(tmp, cursor_path)) {
+		perror(cursor_path);
+		unlink(tmp);
+	}
+}
+
+static long long clock_us(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000L;
+}
+
+static int run_kmsg(int fd)
+{
+	unsigned long long last = 0, saved;
+	char record[KMSG_RECORD_MAX];
+	struct pollfd pfd[2];
+	kmsg_record_t rec;
+	bool have_last;
+	size_t len;
+	ssize_t ret;
+
+	/* the kernel time stamps are relative to boot */
+	boot_time_us = clock_us(CLOCK_REALTIME) - clock_us(CLOCK_MONOTONIC);
+
+	if (read_boot_id())
+		boot_id[0] = '\0';
+
+	have_last = cursor_load(&last);
+	queue.sent_seq = saved = last;
 
 	while (running) {
+		/*
+		  Only read as many records as the queue can hold. While
+		  syslogd is busy or gone, the rest stays in the kernel.
+		 */
+		while (queue_has_room()) {
+			ret = read(fd, record, sizeof(record) - 1);
+
+			if (ret < 0) {
+				if (errno == EINTR)
+					break;
+
+				/*
+				  Records were overwritten before we could
+				  read them. Reading continues with the oldest
+				  one still there, the gap in sequence numbers
+				  tells how many were lost.
+				 */
+				if (errno == EPIPE)
+					continue;
+
+				if (errno == EAGAIN)
+					break;
+
+				log_notice(LOG_KERN | LOG_CRIT, "reading %s: %s",
+					   KMSG_PATH, strerror(errno));
+				return -1;
+			}
+
+			if (kmsg_parse(record, ret, &rec))
+				continue;
+
+			/* already forwarded before a restart */
+			if (have_last && rec.seq <= last)
+				continue;
+
+			if (have_last && rec.seq > last + 1) {
+				log_notice(LOG_KERN | LOG_WARNING, "missed %llu "
+					   "kernel messages, ring buffer overrun",
+					   rec.seq - last - 1);
+			}
+
+			len = kmsg_format(queue_tail(), SEND_MSG_MAX, &rec);
+			queue_commit(len, rec.seq);
+
+			last = rec.seq;
+			have_last = true;
+		}
+
+		queue_flush();
+
+		if (queue.count == 0 && queue.sent_seq != saved) {
+			cursor_save(queue.sent_seq);
+			saved = queue.sent_seq;
+		}
+
+		pfd[0].fd = queue_has_room() ? fd : -1;
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+
+		pfd[1].fd = queue.count > 0 ? log_fd : -1;
+		pfd[1].events = POLLOUT;
+		pfd[1].revents = 0;
+
+		poll(pfd, 2, (queue.count > 0 && log_fd < 0) ?
+		     RETRY_INTERVAL : -1);
+	}
+
+	return 0;
+}
+
+static int run_klogctl(void)
+{
+	int diff, count = 0, priority;
+	char *ptr, *end;
+	size_t len;
+
+	while (running) {
+		/* klogctl() blocks, send everything read so far first */
+		queue_wait(true);
+		if (!running)
+			break;
+
 		diff = klogctl(KLOG_READ, log_buffer + count,
 			       sizeof(log_buffer) - 1 - count);
 
 		if (diff < 0) {
 			if (errno == EINTR)
 				continue;
-			syslog(LOG_CRIT, "klogctl read: %s", strerror(errno));
-			ret = EXIT_FAILURE;
-			break;
+			log_notice(LOG_KERN | LOG_CRIT, "klogctl read: %s",
+				   strerror(errno));
+			return -1;
 		}
 
 		count += diff;
@@ -163,12 +660,79 @@ int main(int argc, char **argv)
 					++ptr;
 			}
 
-			if (*ptr != '\0')
-				syslog(priority, "%s", ptr);
+			if (*ptr != '\0') {
+				queue_wait(false);
+
+				len = snprintf(queue_tail(), SEND_MSG_MAX,
+					       "<%d>kernel: %s", priority, ptr);
+				if (len >= SEND_MSG_MAX)
+					len = SEND_MSG_MAX - 1;
+
+				queue_commit(len, 0);
+			}
 			ptr = end;
 		}
+
+		queue_flush();
+	}
+
+	return 0;
+}
+
+static void log_open(void)
+{
+	klogctl(KLOG_OPEN, NULL, 0);
+
+	if (level) {
+		klogctl(KLOG_CONSOLE_LEVEL, NULL, level);
+	} else {
+		klogctl(KLOG_CONSOLE_OFF, NULL, 0);
+	}
+}
+
+static void log_close(void)
+{
+	klogctl(KLOG_CONSOLE_ON, NULL, 0);
+	klogctl(KLOG_CLOSE, NULL, 0);
+
+	log_notice(LOG_KERN | LOG_NOTICE, "-- klogd terminating --");
+	queue_flush();
+}
+
+int main(int argc, char **argv)
+{
+	int fd = -1, ret = EXIT_SUCCESS;
+
+	process_options(argc, argv);
+	sigsetup();
+	queue_init();
+	log_open();
+
+	if (!use_klogctl) {
+		fd = open(KMSG_PATH, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s, using klogctl\n", KMSG_PATH,
+				strerror(errno));
+		}
+	}
+
+	if (fd >= 0) {
+		if (run_kmsg(fd))
+			ret = EXIT_FAILURE;
+		close(fd);
+	} else if (run_klogctl()) {
+		ret = EXIT_FAILURE;
 	}
 
 	log_close();
+
+	if (fd >= 0 && queue.sent_seq != 0)
+		cursor_save(queue.sent_seq);
+
+	if (queue.count > 0) {
+		fprintf(stderr, "klogd: %zu messages could not be sent\n",
+			queue.count);
+	}
+
 	return ret;
 }
@@ -1,12 +1,15 @@
 /* SPDX-License-Identifier: ISC */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
+#include <syslog.h>
 
 #include "syslogd.h"
 
@@ -15,135 +18,1069 @@ typedef struct logfile_t {
 	struct logfile_t *next;
 	size_t size;
 	int fd;
+
+	/* list of files with an open fd, most recently used first */
+	struct logfile_t *lru_prev;
+	struct logfile_t *lru_next;
+
+	/* set if the fd was closed to stay below the open file limit */
+	bool evicted;
+
+	/* number of messages written since the last sync */
+	unsigned int pending;
+
+	/*
+	  monotonic time in milliseconds at which a sync is due, LLONG_MAX
+	  if the sync policy has not set a deadline
+	 */
+	long long sync_due;
+
+	/* buffered data not yet written to the file */
+	char *buffer;
+	size_t used;
+
+	/* monotonic time in milliseconds at which the buffer is flushed */
+	long long flush_due;
+
+	/* ident_hash of the name, i.e. the filename without extension */
+	uint32_t hash;
+	size_t namelen;
+
+	/* file offset for the next write submitted through io_uring */
+	off_t offset;
+
+	/* number of io_uring requests for this file not yet completed */
+	unsigned int inflight;
+
+	/* index of the io_uring buffer in use, if buffer is not NULL */
+	unsigned int bufidx;
+
+	/* monotonic time in microseconds at which an fsync was queued */
+	long long sync_start;
+
+	/* messages and bytes written to the stream, for statistics */
+	uint64_t messages;
+	uint64_t bytes;
+
+	/*
+	  Name of a rotated file that is handed over to the archive thread
+	  once the writes and the close queued through io_uring completed.
+	 */
+	char *rotated;
+
+	/* end of the disk space preallocated for the file */
+	off_t reserved;
+
+	/*
+	  Duplicate of the fd of a file closed through io_uring, used to
+	  release its preallocated space once the close has completed.
+	 */
+	int trim_fd;
+
 	char filename[];
 } logfile_t;
 
+#ifdef HAVE_LINUX_IO_URING_H
+#define URING_ENTRIES 256
+#define URING_BUFFERS 128
+#define URING_MIN_BUFSIZE 4096
+#endif
+
+/* tick interval in milliseconds while io_uring requests are in flight */
+#define URING_POLL_INTERVAL 50
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+enum {
+	REQ_WRITE = 0,
+	REQ_FSYNC = 1,
+	REQ_CLOSE = 2,
+};
+
+typedef struct {
+	uring_t ring;
+
+	/* buffers registered with the ring, URING_BUFFERS * bufsize bytes */
+	char *pool;
+	bool fixed;
+
+	/* the file and size of the write for each buffer in flight */
+	logfile_t *buf_file[URING_BUFFERS];
+	size_t buf_len[URING_BUFFERS];
+
+	/* indices of unused buffers */
+	unsigned int free_list[URING_BUFFERS];
+	unsigned int free_count;
+} uring_io_t;
+#endif
+
 
 typedef struct {
 	log_backend_t base;
 	logfile_t *list;
+
+	/* open addressing hash table of all files, indexed by hash */
+	logfile_t **table;
+	size_t table_size;
+	size_t count;
+
+	/* ident_hash of each facility name */
+	uint32_t fac_hash[SYSLOG_NUM_FACILITIES];
+
+	/* files with an open fd, in least recently used order */
+	logfile_t *lru_head;
+	logfile_t *lru_tail;
+	size_t open_count;
+	size_t max_open;
+
+	/* set for the io_uring based variant of the backend */
+	bool want_uring;
+#ifdef HAVE_LINUX_IO_URING_H
+	/* NULL if io_uring is not used */
+	uring_io_t *uring;
+#endif
+
 	size_t maxsize;
 	int flags;
+
+	int sync_mode;
+	unsigned int sync_count;
+	unsigned int sync_interval;
+	bool sync_urgent;
+
+	size_t bufsize;
+	unsigned int flush_interval;
+	size_t prealloc;
+
+	/* earliest sync_due or flush_due of all files */
+	long long next_deadline;
 } log_backend_file_t;
 
 
-static int logfile_open(logfile_t *file)
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000L;
+}
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000L;
+}
+
+static int write_all(int fd, struct iovec *iov, int count)
+{
+	ssize_t ret;
+
+	while (count > 0) {
+		ret = writev(fd, iov, count);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		while (count > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			++iov;
+			--count;
+		}
+
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+  Writes through io_uring go to explicit offsets, which O_APPEND would
+  override, so it is only used for synchronous writes.
+ */
+static int logfile_open(logfile_t *file, bool append)
 {
 	struct stat sb;
 
-	file->fd = open(file->filename, O_WRONLY | O_CREAT, 0640);
+	file->fd = open(file->filename,
+			O_WRONLY | O_CREAT | (append ? O_APPEND : 0), 0640);
 	if (file->fd < 0) {
 		perror(file->filename);
+		STATS_ADD(stats.write_errors, 1);
 		return -1;
 	}
 
-	if (lseek(file->fd, 0, SEEK_END))
+	if (!append && lseek(file->fd, 0, SEEK_END) < 0)
 		goto fail;
 
 	if (fstat(file->fd, &sb))
 		goto fail;
 
+	STATS_ADD(stats.live_bytes, sb.st_size - (off_t)file->size);
 	file->size = sb.st_size;
+	file->offset = sb.st_size;
+	file->reserved = sb.st_size;
 	return 0;
 fail:
 	perror(file->filename);
+	STATS_ADD(stats.write_errors, 1);
 	close(file->fd);
 	file->fd = -1;
 	return -1;
 }
 
-static logfile_t *logfile_create(const char *filename)
+static logfile_t *logfile_create(const char *name, uint32_t hash,
+				  size_t bufsize)
 {
-	logfile_t *file = calloc(1, sizeof(*file) + strlen(filename) + 1);
+	size_t len = strlen(name);
+	logfile_t *file;
 
+	file = calloc(1, sizeof(*file) + len + sizeof(".log"));
 	if (file == NULL) {
 		perror("calloc");
 		return NULL;
 	}
 
-	strcpy(file->filename, filename);
+	file->fd = -1;
+	file->trim_fd = -1;
+	file->sync_due = LLONG_MAX;
+	memcpy(file->filename, name, len);
+	strcpy(file->filename + len, ".log");
+	file->namelen = len;
+	file->hash = hash;
 
-	if (logfile_open(file)) {
-		free(file);
-		return NULL;
+	if (bufsize > 0) {
+		file->buffer = malloc(bufsize);
+		if (file->buffer == NULL) {
+			perror("malloc");
+			free(file);
+			return NULL;
+		}
 	}
 
 	return file;
 }
 
-static int logfile_write(logfile_t *file, const syslog_msg_t *msg)
+static void logfile_destroy(logfile_t *file)
 {
-	const char *lvl_str, *fac_name;
-	char timebuf[32];
-	struct tm tm;
-	int ret;
+	if (file->fd >= 0)
+		close(file->fd);
+	if (file->trim_fd >= 0)
+		close(file->trim_fd);
+	free(file->rotated);
+	free(file->buffer);
+	free(file);
+}
+
+/*
+  Write out buffered data, followed by the given extra data, using a
+  single system call. If writing fails, the data is dropped and the
+  size accounting adjusted to match what actually is in the file.
+ */
+static int logfile_flush_iov(logfile_t *file, struct iovec *extra, int count)
+{
+	struct iovec iov[6];
+	size_t total;
+	int i;
+
+	iov[0].iov_base = file->buffer;
+	iov[0].iov_len = file->used;
+	total = file->used;
 
-	if (file->fd < 0 && logfile_open(file) != 0)
+	for (i = 0; i < count; ++i) {
+		iov[i + 1] = extra[i];
+		total += extra[i].iov_len;
+	}
+
+	file->used = 0;
+
+	if (total == 0)
+		return 0;
+
+	if (write_all(file->fd, iov, count + 1)) {
+		perror(file->filename);
+		STATS_ADD(stats.write_errors, 1);
+		STATS_ADD(stats.live_bytes, -(int64_t)total);
+		file->size -= total;
 		return -1;
+	}
 
-	lvl_str = level_id_to_string(msg->level);
-	if (lvl_str == NULL)
+	return 0;
+}
+
+static int logfile_flush(logfile_t *file)
+{
+	if (file->used == 0 || file->fd < 0)
+		return 0;
+
+	return logfile_flush_iov(file, NULL, 0);
+}
+
+/*
+  Lines of a log stream selected by the routing rules can come from any
+  ident and facility, so both are included.
+ */
+static int logfile_write(logfile_t *file, size_t bufsize,
+			 const syslog_msg_t *msg)
+{
+	const char *ident = msg->stream != NULL ? msg->ident : NULL;
+	size_t ret, len, total, identlen = 0;
+	char prefix[FORMAT_PREFIX_MAX];
+	struct iovec iov[5];
+	int i = 0;
+
+	ret = format_prefix(prefix, msg, msg->ident != NULL ||
+			    msg->stream != NULL);
+	if (ret == 0)
 		return -1;
 
-	gmtime_r(&msg->timestamp, &tm);
-	strftime(timebuf, sizeof(timebuf), "%FT%T", &tm);
+	if (ident != NULL)
+		identlen = strlen(ident);
 
-	if (msg->ident != NULL) {
-		fac_name = facility_id_to_string(msg->facility);
-		if (fac_name == NULL)
-			return -1;
+	len = strlen(msg->message);
+	total = ret + len + 1 + (ident != NULL ? identlen + 2 : 0);
+	file->size += total;
+	STATS_ADD(stats.live_bytes, total);
+
+	if (total <= bufsize - file->used) {
+		memcpy(file->buffer + file->used, prefix, ret);
+		file->used += ret;
+		if (ident != NULL) {
+			memcpy(file->buffer + file->used, ident, identlen);
+			file->used += identlen;
+			file->buffer[file->used++] = ':';
+			file->buffer[file->used++] = ' ';
+		}
+		memcpy(file->buffer + file->used, msg->message, len);
+		file->used += len;
+		file->buffer[file->used++] = '\n';
+		return 0;
+	}
+
+	iov[i].iov_base = prefix;
+	iov[i++].iov_len = ret;
+	if (ident != NULL) {
+		iov[i].iov_base = (char *)ident;
+		iov[i++].iov_len = identlen;
+		iov[i].iov_base = (char *)": ";
+		iov[i++].iov_len = 2;
+	}
+	iov[i].iov_base = (char *)msg->message;
+	iov[i++].iov_len = len;
+	iov[i].iov_base = (char *)"\n";
+	iov[i++].iov_len = 1;
 
-		ret = dprintf(file->fd, "[%s][%s][%s][%u] %s\n", timebuf,
-			      fac_name, lvl_str, msg->pid, msg->message);
+	return logfile_flush_iov(file, iov, i);
+}
+
+static void logfile_close(logfile_t *file)
+{
+	if (file->fd >= 0) {
+		close(file->fd);
+		file->fd = -1;
+	}
+}
+
+/*
+  Release disk space preallocated past the end of a file. Truncating to
+  the current size frees blocks reserved with FALLOC_FL_KEEP_SIZE.
+ */
+static void logfile_trim(int fd, const char *name)
+{
+	struct stat sb;
+
+	if (fstat(fd, &sb) || ftruncate(fd, sb.st_size)) {
+		perror(name);
+		STATS_ADD(stats.write_errors, 1);
+	}
+}
+
+static void logfile_sync(logfile_t *file, int mode)
+{
+	long long start;
+	int ret;
+
+	logfile_flush(file);
+
+	if (file->pending == 0 || file->fd < 0)
+		return;
+
+	start = now_us();
+
+	if (mode == LOG_SYNC_DATA) {
+		ret = fdatasync(file->fd);
 	} else {
-		ret = dprintf(file->fd, "[%s][%s][%u] %s\n", timebuf, lvl_str,
-			      msg->pid, msg->message);
+		ret = fsync(file->fd);
 	}
 
-	fsync(file->fd);
+	stats_fsync(now_us() - start);
 
-	if (ret > 0)
-		file->size += ret;
-	return 0;
+	if (ret != 0) {
+		perror(file->filename);
+		STATS_ADD(stats.write_errors, 1);
+	}
+
+	file->pending = 0;
+	file->sync_due = LLONG_MAX;
 }
 
-static int logfile_rotate(logfile_t *f, int flags)
+/* Returns the new name of the file, or NULL on failure. */
+static char *logfile_rename(logfile_t *f, int flags)
 {
 	char timebuf[32];
 	char *filename;
-	struct tm tm;
-	time_t now;
 
 	if (flags & LOG_ROTATE_OVERWRITE) {
 		strcpy(timebuf, "1");
 	} else {
-		now = time(NULL);
-		gmtime_r(&now, &tm);
-		strftime(timebuf, sizeof(timebuf), "%FT%T", &tm);
+		format_timestamp(timebuf, time(NULL));
+	}
+
+	filename = malloc(strlen(f->filename) + strlen(timebuf) + 2);
+	if (filename == NULL) {
+		perror("malloc");
+		return NULL;
 	}
 
-	filename = alloca(strlen(f->filename) + strlen(timebuf) + 2);
 	sprintf(filename, "%s.%s", f->filename, timebuf);
 
 	if (rename(f->filename, filename)) {
 		perror(filename);
+		free(filename);
+		return NULL;
+	}
+
+	return filename;
+}
+
+/*****************************************************************************/
+
+static void lru_remove(log_backend_file_t *log, logfile_t *file)
+{
+	if (file->lru_prev == NULL) {
+		log->lru_head = file->lru_next;
+	} else {
+		file->lru_prev->lru_next = file->lru_next;
+	}
+
+	if (file->lru_next == NULL) {
+		log->lru_tail = file->lru_prev;
+	} else {
+		file->lru_next->lru_prev = file->lru_prev;
+	}
+
+	file->lru_prev = NULL;
+	file->lru_next = NULL;
+}
+
+static void lru_push(log_backend_file_t *log, logfile_t *file)
+{
+	file->lru_prev = NULL;
+	file->lru_next = log->lru_head;
+
+	if (log->lru_head == NULL) {
+		log->lru_tail = file;
+	} else {
+		log->lru_head->lru_prev = file;
+	}
+
+	log->lru_head = file;
+}
+
+/*****************************************************************************/
+
+#ifdef HAVE_LINUX_IO_URING_H
+static void uring_report(log_backend_file_t *log, logfile_t *file, int err)
+{
+	fprintf(stderr, "%s: %s\n", file->filename, strerror(err));
+	STATS_ADD(stats.write_errors, 1);
+	(void)log;
+}
+
+static void uring_reap(log_backend_file_t *log)
+{
+	uring_io_t *io = log->uring;
+	struct io_uring_cqe *cqe;
+	unsigned int idx;
+	logfile_t *file;
+	uint64_t data;
+
+	while ((cqe = uring_peek_cqe(&io->ring)) != NULL) {
+		data = cqe->user_data;
+
+		if ((data & 0x03) == REQ_WRITE) {
+			idx = data >> 2;
+			file = io->buf_file[idx];
+
+			if (cqe->res < 0) {
+				uring_report(log, file, -cqe->res);
+			} else if ((size_t)cqe->res != io->buf_len[idx]) {
+				uring_report(log, file, EIO);
+			}
+
+			io->free_list[io->free_count++] = idx;
+		} else {
+			file = (logfile_t *)(uintptr_t)(data & ~0x03ULL);
+
+			if ((data & 0x03) == REQ_FSYNC)
+				stats_fsync(now_us() - file->sync_start);
+
+			if (cqe->res < 0)
+				uring_report(log, file, -cqe->res);
+
+			if ((data & 0x03) == REQ_CLOSE &&
+			    file->trim_fd >= 0) {
+				logfile_trim(file->trim_fd, file->filename);
+				close(file->trim_fd);
+				file->trim_fd = -1;
+			}
+
+			if ((data & 0x03) == REQ_CLOSE &&
+			    file->rotated != NULL) {
+				archive_submit(file->rotated, -1, 0);
+				free(file->rotated);
+				file->rotated = NULL;
+			}
+		}
+
+		file->inflight -= 1;
+		uring_cqe_seen(&io->ring);
+	}
+}
+
+/* Make sure that count entries can be queued without waiting. */
+static void uring_reserve(log_backend_file_t *log, unsigned int count)
+{
+	uring_t *ring = &log->uring->ring;
+	unsigned int head;
+
+	for (;;) {
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+		if (ring->sqe_tail - head + count <= ring->sq_entries &&
+		    ring->inflight + count <= ring->cq_entries) {
+			break;
+		}
+
+		if (uring_submit(ring, 1))
+			perror("io_uring_enter");
+		uring_reap(log);
+	}
+}
+
+/* Queue a write of the buffered data and detach the buffer from the file. */
+static void uring_flush(log_backend_file_t *log, logfile_t *file,
+			unsigned int flags)
+{
+	uring_io_t *io = log->uring;
+	struct io_uring_sqe *sqe;
+
+	if (file->buffer == NULL)
+		return;
+
+	if (file->used == 0) {
+		io->free_list[io->free_count++] = file->bufidx;
+		file->buffer = NULL;
+		return;
+	}
+
+	uring_reserve(log, 1);
+	sqe = uring_get_sqe(&io->ring);
+
+	if (io->fixed) {
+		sqe->opcode = IORING_OP_WRITE_FIXED;
+		sqe->buf_index = file->bufidx;
+	} else {
+		sqe->opcode = IORING_OP_WRITE;
+	}
+
+	sqe->flags = flags;
+	sqe->fd = file->fd;
+	sqe->addr = (uintptr_t)file->buffer;
+	sqe->len = file->used;
+	sqe->off = file->offset;
+	sqe->user_data = ((uint64_t)file->bufidx << 2) | REQ_WRITE;
+
+	io->buf_file[file->bufidx] = file;
+	io->buf_len[file->bufidx] = file->used;
+
+	file->offset += file->used;
+	file->inflight += 1;
+	file->buffer = NULL;
+	file->used = 0;
+}
+
+static void uring_queue(log_backend_file_t *log, logfile_t *file,
+			int opcode, unsigned int flags)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(&log->uring->ring);
+
+	sqe->opcode = opcode;
+	sqe->flags = flags;
+	sqe->fd = file->fd;
+	sqe->user_data = (uintptr_t)file | (opcode == IORING_OP_CLOSE ?
+					     REQ_CLOSE : REQ_FSYNC);
+
+	if (opcode == IORING_OP_FSYNC) {
+		if (log->sync_mode == LOG_SYNC_DATA)
+			sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		file->sync_start = now_us();
+	}
+
+	file->inflight += 1;
+}
+
+/*
+  Queue a linked chain of write, fsync (if sync is set and the file has
+  unsynced data) and close (if requested). If earlier requests for the
+  file are still in flight, the chain is only started once all previous
+  requests have completed, so the fsync covers them as well.
+ */
+static void uring_finish(log_backend_file_t *log, logfile_t *file,
+			 bool sync, bool close)
+{
+	unsigned int flags = file->inflight > 0 ? IOSQE_IO_DRAIN : 0;
+	bool write = file->buffer != NULL && file->used > 0;
+
+	sync = sync && (file->pending > 0 || write);
+
+	if (!sync && !close) {
+		uring_flush(log, file, 0);
+		return;
+	}
+
+	uring_reserve(log, 3);
+
+	if (write) {
+		uring_flush(log, file, flags | IOSQE_IO_HARDLINK);
+		flags = 0;
+	} else {
+		uring_flush(log, file, 0);
+	}
+
+	if (sync) {
+		uring_queue(log, file, IORING_OP_FSYNC,
+			    flags | (close ? IOSQE_IO_HARDLINK : 0));
+		file->pending = 0;
+		file->sync_due = LLONG_MAX;
+		flags = 0;
+	}
+
+	if (close) {
+		uring_queue(log, file, IORING_OP_CLOSE, flags);
+		file->fd = -1;
+	}
+}
+
+/* Attach a buffer with room for at least len bytes to a file. */
+static int uring_prepare(log_backend_file_t *log, logfile_t *file,
+			 size_t len)
+{
+	uring_io_t *io = log->uring;
+	logfile_t *f;
+
+	if (len > log->bufsize)
 		return -1;
+
+	if (file->buffer != NULL) {
+		if (len <= log->bufsize - file->used)
+			return 0;
+		uring_flush(log, file, 0);
 	}
 
-	close(f->fd);
-	logfile_open(f);
+	while (io->free_count == 0) {
+		if (io->ring.inflight > 0) {
+			if (uring_submit(&io->ring, 1))
+				perror("io_uring_enter");
+			uring_reap(log);
+			continue;
+		}
+
+		/* every buffer is attached to a file, write one out */
+		for (f = log->lru_tail; f != NULL; f = f->lru_prev) {
+			if (f->buffer != NULL && f != file)
+				break;
+		}
+
+		if (f == NULL)
+			return -1;
+
+		uring_flush(log, f, 0);
+	}
+
+	file->bufidx = io->free_list[--io->free_count];
+	file->buffer = io->pool + (size_t)file->bufidx * log->bufsize;
+	file->used = 0;
 	return 0;
 }
 
-/*****************************************************************************/
+static int uring_setup(log_backend_file_t *log)
+{
+	struct iovec iov[URING_BUFFERS];
+	uring_io_t *io;
+	unsigned int i;
+
+	if (log->bufsize < URING_MIN_BUFSIZE) {
+		/* unbuffered: write out everything on the next tick */
+		if (log->bufsize == 0)
+			log->flush_interval = 0;
+		log->bufsize = URING_MIN_BUFSIZE;
+	}
+
+	io = calloc(1, sizeof(*io));
+	if (io == NULL) {
+		perror("calloc");
+		return -1;
+	}
 
-static int file_backend_init(log_backend_t *backend, int flags,
-			     size_t sizelimit)
+	if (uring_init(&io->ring, URING_ENTRIES)) {
+		fprintf(stderr, "io_uring not available (%s), "
+			"using synchronous file I/O\n", strerror(errno));
+		free(io);
+		return 0;
+	}
+
+	io->pool = malloc((size_t)URING_BUFFERS * log->bufsize);
+	if (io->pool == NULL) {
+		perror("allocating io_uring buffers");
+		uring_cleanup(&io->ring);
+		free(io);
+		return -1;
+	}
+
+	for (i = 0; i < URING_BUFFERS; ++i) {
+		iov[i].iov_base = io->pool + (size_t)i * log->bufsize;
+		iov[i].iov_len = log->bufsize;
+		io->free_list[i] = URING_BUFFERS - 1 - i;
+	}
+
+	io->free_count = URING_BUFFERS;
+	io->fixed = uring_register_buffers(&io->ring, iov,
+					   URING_BUFFERS) == 0;
+
+	if (!io->fixed) {
+		fprintf(stderr, "registering io_uring buffers: %s\n",
+			strerror(errno));
+	}
+
+	log->uring = io;
+	return 0;
+}
+
+static void uring_teardown(log_backend_file_t *log)
+{
+	uring_io_t *io = log->uring;
+
+	while (io->ring.inflight > 0) {
+		if (uring_submit(&io->ring, 1)) {
+			perror("io_uring_enter");
+			break;
+		}
+		uring_reap(log);
+	}
+
+	uring_cleanup(&io->ring);
+	free(io->pool);
+	free(io);
+	log->uring = NULL;
+}
+#endif /* HAVE_LINUX_IO_URING_H */
+
+static void file_backend_set_deadline(log_backend_file_t *log,
+				      long long deadline)
+{
+	if (deadline < log->next_deadline)
+		log->next_deadline = deadline;
+}
+
+static bool file_backend_async(log_backend_file_t *log)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	return log->uring != NULL;
+#else
+	(void)log;
+	return false;
+#endif
+}
+
+static void file_backend_flush(log_backend_file_t *log, logfile_t *file)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	if (file_backend_async(log)) {
+		uring_finish(log, file, false, false);
+		return;
+	}
+#endif
+	logfile_flush(file);
+	(void)log;
+}
+
+static void file_backend_sync(log_backend_file_t *log, logfile_t *file,
+			      int mode)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	/*
+	  The fsync completes asynchronously either way, so instead of
+	  queueing one per message, do a single one for the whole batch
+	  of received messages on the next tick.
+	 */
+	if (file_backend_async(log)) {
+		file->pending += file->pending == 0;
+		file->sync_due = 0;
+		file_backend_set_deadline(log, 0);
+		return;
+	}
+#endif
+	(void)log;
+	logfile_sync(file, mode);
+}
+
+static void file_backend_sync_now(log_backend_file_t *log, logfile_t *file)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	if (file_backend_async(log)) {
+		uring_finish(log, file, true, false);
+		return;
+	}
+#endif
+	logfile_sync(file, log->sync_mode);
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+/*
+  Writes queued for the file may still be in flight, so its preallocated
+  space is released through a duplicate of the fd once the close queued
+  after them has completed.
+ */
+static void uring_trim_later(log_backend_file_t *log, logfile_t *file)
+{
+	uring_io_t *io = log->uring;
+
+	/* closed again before the last close completed */
+	while (file->trim_fd >= 0) {
+		if (uring_submit(&io->ring, 1))
+			perror("io_uring_enter");
+		uring_reap(log);
+	}
+
+	file->trim_fd = fcntl(file->fd, F_DUPFD_CLOEXEC, 0);
+	if (file->trim_fd < 0)
+		perror(file->filename);
+}
+#endif
+
+#ifdef HAVE_LINUX_IO_URING_H
+/* Wait until all requests queued for a file have completed. */
+static void uring_drain(log_backend_file_t *log, logfile_t *file)
+{
+	while (file->inflight > 0) {
+		if (uring_submit(&log->uring->ring, 1))
+			perror("io_uring_enter");
+		uring_reap(log);
+	}
+}
+#endif
+
+/* Update the bookkeeping for a file whose fd was closed or handed over. */
+static void file_backend_detach(log_backend_file_t *log, logfile_t *file)
+{
+	file->reserved = 0;
+	file->pending = 0;
+	file->sync_due = LLONG_MAX;
+	lru_remove(log, file);
+	log->open_count -= 1;
+}
+
+/* Write out and close a file that currently has an open fd. */
+static void file_backend_close(log_backend_file_t *log, logfile_t *file)
+{
+	bool sync = log->sync_mode != LOG_SYNC_NONE;
+	bool trim = file->reserved > (off_t)file->size;
+
+	if (file_backend_async(log)) {
+#ifdef HAVE_LINUX_IO_URING_H
+		if (trim)
+			uring_trim_later(log, file);
+
+		uring_finish(log, file, sync, true);
+#endif
+	} else {
+		logfile_flush(file);
+
+		if (sync)
+			logfile_sync(file, log->sync_mode);
+
+		if (trim)
+			logfile_trim(file->fd, file->filename);
+
+		logfile_close(file);
+	}
+
+	file_backend_detach(log, file);
+}
+
+/*
+  Submit queued io_uring requests and process completions. Returns true
+  while requests are still in flight.
+ */
+static bool file_backend_complete(log_backend_file_t *log)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	if (file_backend_async(log)) {
+		if (uring_submit(&log->uring->ring, 0))
+			perror("io_uring_enter");
+		uring_reap(log);
+		return log->uring->ring.inflight > 0;
+	}
+#endif
+	(void)log;
+	return false;
+}
+
+/*
+  Make sure a file has an open fd and mark it as most recently used. If
+  too many files are open, the least recently used one is closed first.
+ */
+static int file_backend_acquire(log_backend_file_t *log, logfile_t *file)
+{
+	if (file->fd >= 0) {
+		if (log->lru_head != file) {
+			lru_remove(log, file);
+			lru_push(log, file);
+		}
+		return 0;
+	}
+
+	while (log->max_open > 0 && log->open_count >= log->max_open &&
+	       log->lru_tail != NULL) {
+		log->lru_tail->evicted = true;
+		file_backend_close(log, log->lru_tail);
+		STATS_ADD(stats.evictions, 1);
+	}
+
+#ifdef HAVE_LINUX_IO_URING_H
+	/*
+	  The writes queued before the eviction go to offsets past the
+	  current end of the file, which the new ones have to start after.
+	 */
+	if (file->evicted && file_backend_async(log))
+		uring_drain(log, file);
+#endif
+
+	if (logfile_open(file, !file_backend_async(log)))
+		return -1;
+
+	if (file->evicted) {
+		file->evicted = false;
+		STATS_ADD(stats.reopens, 1);
+	}
+
+	lru_push(log, file);
+	log->open_count += 1;
+	return 0;
+}
+
+static bool logfile_match(const logfile_t *file, const char *name,
+			  uint32_t hash)
+{
+	return file->hash == hash &&
+		strncmp(file->filename, name, file->namelen) == 0 &&
+		name[file->namelen] == '\0';
+}
+
+static logfile_t *file_backend_find(log_backend_file_t *log,
+				    const char *name, uint32_t hash)
+{
+	size_t i, mask = log->table_size - 1;
+	logfile_t *f;
+
+	if (log->table == NULL)
+		return NULL;
+
+	for (i = hash & mask; (f = log->table[i]) != NULL; i = (i + 1) & mask) {
+		if (logfile_match(f, name, hash))
+			return f;
+	}
+
+	return NULL;
+}
+
+static void table_insert(logfile_t **table, size_t size, logfile_t *file)
+{
+	size_t i, mask = size - 1;
+
+	for (i = file->hash & mask; table[i] != NULL; i = (i + 1) & mask)
+		;
+
+	table[i] = file;
+}
+
+static int file_backend_insert(log_backend_file_t *log, logfile_t *file)
+{
+	logfile_t **table, *f;
+	size_t size;
+
+	/* keep the load factor at or below 1/2 */
+	if ((log->count + 1) * 2 > log->table_size) {
+		size = log->table_size ? log->table_size * 2 : 64;
+
+		table = calloc(size, sizeof(table[0]));
+		if (table == NULL) {
+			perror("calloc");
+			return -1;
+		}
+
+		for (f = log->list; f != NULL; f = f->next)
+			table_insert(table, size, f);
+
+		free(log->table);
+		log->table = table;
+		log->table_size = size;
+	}
+
+	table_insert(log->table, log->table_size, file);
+	log->count += 1;
+
+	file->next = log->list;
+	log->list = file;
+	return 0;
+}
+
+static int file_backend_init(log_backend_t *backend, const log_config_t *cfg)
 {
 	log_backend_file_t *log = (log_backend_file_t *)backend;
+	int i;
 
-	log->flags = flags;
-	log->maxsize = sizelimit;
+	log->flags = cfg->flags;
+	log->maxsize = cfg->sizelimit;
+	log->sync_mode = cfg->sync_mode;
+	log->sync_count = cfg->sync_count;
+	log->sync_interval = cfg->sync_interval;
+	log->sync_urgent = cfg->sync_urgent;
+	log->bufsize = cfg->buffer_size;
+	log->flush_interval = cfg->flush_interval;
+	log->next_deadline = LLONG_MAX;
+	log->max_open = cfg->max_open;
+	log->prealloc = cfg->prealloc;
+
+	for (i = 0; i < SYSLOG_NUM_FACILITIES; ++i)
+		log->fac_hash[i] = ident_hash(facility_id_to_string(i));
+
+	if (log->want_uring) {
+#ifdef HAVE_LINUX_IO_URING_H
+		return uring_setup(log);
+#else
+		fputs("io_uring support not compiled in, "
+		      "using synchronous file I/O\n", stderr);
+#endif
+	}
 	return 0;
 }
 
@@ -152,54 +1089,236 @@ static void file_backend_cleanup(log_backend_t *backend)
 	log_backend_file_t *log = (log_backend_file_t *)backend;
 	logfile_t *f;
 
+	for (f = log->list; f != NULL; f = f->next) {
+		if (f->fd >= 0)
+			file_backend_close(log, f);
+	}
+
+#ifdef HAVE_LINUX_IO_URING_H
+	/* wait for the queued writes and closes to complete */
+	if (file_backend_async(log))
+		uring_teardown(log);
+#endif
+
 	while (log->list != NULL) {
 		f = log->list;
 		log->list = f->next;
+		logfile_destroy(f);
+	}
+
+	free(log->table);
+	log->table = NULL;
+	log->table_size = 0;
+	log->count = 0;
+}
+
+static void file_backend_sync_policy(log_backend_file_t *log, logfile_t *f,
+				     int level)
+{
+	if (log->sync_urgent && level <= LOG_CRIT) {
+		f->pending = 1;
+		file_backend_sync(log, f, log->sync_mode == LOG_SYNC_DATA ?
+				  LOG_SYNC_DATA : LOG_SYNC_FULL);
+		return;
+	}
+
+	if (log->sync_mode == LOG_SYNC_NONE)
+		return;
+
+	f->pending += 1;
+
+	if (log->sync_count == 0 && log->sync_interval == 0) {
+		file_backend_sync(log, f, log->sync_mode);
+		return;
+	}
 
-		close(f->fd);
-		free(f);
+	if (log->sync_count > 0 && f->pending >= log->sync_count) {
+		file_backend_sync(log, f, log->sync_mode);
+		return;
+	}
+
+	if (log->sync_interval > 0 && f->pending == 1) {
+		f->sync_due = now_ms() + log->sync_interval;
+		file_backend_set_deadline(log, f->sync_due);
 	}
 }
 
+/*
+  Preallocate the next chunk of disk space for a file once the data
+  written so far plus a full buffer would not fit into the space already
+  reserved, so that flushing the buffer does not have to allocate blocks.
+ */
+static void file_backend_reserve(log_backend_file_t *log, logfile_t *f)
+{
+	off_t target;
+
+	if (log->prealloc == 0 ||
+	    (off_t)(f->size + log->bufsize) <= f->reserved) {
+		return;
+	}
+
+	target = f->size + log->prealloc;
+
+	if ((log->flags & LOG_ROTATE_SIZE_LIMIT) &&
+	    target > (off_t)log->maxsize) {
+		target = log->maxsize;
+	}
+
+	if (target <= f->reserved)
+		return;
+
+	/*
+	  If it fails, don't try again for every message. Running out of
+	  space is reported by the writes anyway.
+	 */
+	if (fallocate(f->fd, FALLOC_FL_KEEP_SIZE, f->reserved,
+		      target - f->reserved) &&
+	    errno != EOPNOTSUPP && errno != ENOSPC) {
+		perror(f->filename);
+	}
+
+	f->reserved = target;
+}
+
+/*
+  The rotated file is closed. It is opened again on the next write, which
+  creates a new, empty file. Data still buffered for the file ends up in
+  the renamed file, since it is written through the old fd.
+
+  With synchronous I/O, only the buffer is written out here. Syncing and
+  closing the old fd is left to the archive thread, so that a rotation
+  does not stall the daemon. Through io_uring, that is done asynchronously
+  anyway and the renamed file is handed over once the close completed.
+ */
+static void file_backend_rotate_file(log_backend_file_t *log, logfile_t *f)
+{
+	char *rotated;
+	int flags = 0;
+
+	/* not written to again since the last rotation, nothing to rename */
+	if (f->fd < 0 && f->size == 0 && !f->evicted)
+		return;
+
+	rotated = logfile_rename(f, log->flags);
+	if (rotated == NULL)
+		return;
+
+	STATS_ADD(stats.rotations, 1);
+
+	/* the next write creates a new file, it is not reopened */
+	f->evicted = false;
+
+	if (f->fd >= 0 && !file_backend_async(log)) {
+		logfile_flush(f);
+
+		if (log->sync_mode != LOG_SYNC_NONE && f->pending > 0) {
+			flags |= log->sync_mode == LOG_SYNC_DATA ?
+				ARCHIVE_DATASYNC : ARCHIVE_SYNC;
+		}
+
+		if (f->reserved > (off_t)f->size)
+			flags |= ARCHIVE_TRIM;
+
+		archive_submit(rotated, f->fd, flags);
+		f->fd = -1;
+		file_backend_detach(log, f);
+		STATS_ADD(stats.live_bytes, -(int64_t)f->size);
+		f->size = 0;
+		free(rotated);
+		return;
+	}
+
+	if (f->fd >= 0)
+		file_backend_close(log, f);
+
+	STATS_ADD(stats.live_bytes, -(int64_t)f->size);
+	f->size = 0;
+
+	if (f->inflight > 0) {
+		/* rotated again before the close of the last one completed */
+		if (f->rotated != NULL) {
+			archive_submit(f->rotated, -1, 0);
+			free(f->rotated);
+		}
+		f->rotated = rotated;
+		return;
+	}
+
+	archive_submit(rotated, -1, 0);
+	free(rotated);
+}
+
 static int file_backend_write(log_backend_t *backend, const syslog_msg_t *msg)
 {
 	log_backend_file_t *log = (log_backend_file_t *)backend;
 	const char *ident;
-	char *filename;
+	bool was_empty;
+	uint32_t hash;
+	size_t size;
 	logfile_t *f;
-	size_t len;
 
-	if (msg->ident != NULL) {
+	if (msg->stream != NULL) {
+		ident = msg->stream;
+		hash = msg->stream_hash;
+	} else if (msg->ident != NULL) {
 		ident = msg->ident;
+		hash = msg->ident_hash;
 	} else {
 		ident = facility_id_to_string(msg->facility);
 		if (ident == NULL)
 			return -1;
+		hash = log->fac_hash[msg->facility];
 	}
 
-	len = strlen(ident) + strlen(".log") + 1;
-	filename = alloca(len);
-	strcpy(filename, ident);
-	strcat(filename, ".log");
-
-	for (f = log->list; f != NULL; f = f->next) {
-		if (strcmp(filename, f->filename) == 0)
-			break;
-	}
+	f = file_backend_find(log, ident, hash);
 
 	if (f == NULL) {
-		f = logfile_create(filename);
+		f = logfile_create(ident, hash, file_backend_async(log) ?
+				   0 : log->bufsize);
 		if (f == NULL)
 			return -1;
-		f->next = log->list;
-		log->list = f;
+
+		if (file_backend_insert(log, f)) {
+			logfile_destroy(f);
+			return -1;
+		}
+	}
+
+	if (file_backend_acquire(log, f))
+		return -1;
+
+	file_backend_reserve(log, f);
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (file_backend_async(log) &&
+	    uring_prepare(log, f, FORMAT_PREFIX_MAX +
+			  (msg->stream != NULL && msg->ident != NULL ?
+			   strlen(msg->ident) + 2 : 0) +
+			  strlen(msg->message) + 1)) {
+		return -1;
 	}
+#endif
 
-	if (logfile_write(f, msg))
+	was_empty = (f->used == 0);
+	size = f->size;
+
+	if (logfile_write(f, log->bufsize, msg))
 		return -1;
 
+	f->messages += 1;
+	f->bytes += f->size - size;
+
+	archive_check_budget();
+
+	if (was_empty && f->used > 0) {
+		f->flush_due = now_ms() + log->flush_interval;
+		file_backend_set_deadline(log, f->flush_due);
+	}
+
+	file_backend_sync_policy(log, f, msg->level);
+
 	if ((log->flags & LOG_ROTATE_SIZE_LIMIT) && f->size >= log->maxsize)
-		logfile_rotate(f, log->flags);
+		file_backend_rotate_file(log, f);
 
 	return 0;
 }
@@ -210,7 +1329,70 @@ static void file_backend_rotate(log_backend_t *backend)
 	logfile_t *f;
 
 	for (f = log->list; f != NULL; f = f->next)
-		logfile_rotate(f, log->flags);
+		file_backend_rotate_file(log, f);
+}
+
+static int file_backend_tick(log_backend_t *backend)
+{
+	log_backend_file_t *log = (log_backend_file_t *)backend;
+	long long now, next = LLONG_MAX;
+	int poll = -1;
+	logfile_t *f;
+
+	/* completions are picked up by polling while I/O is in flight */
+	if (file_backend_complete(log))
+		poll = URING_POLL_INTERVAL;
+
+	if (log->next_deadline == LLONG_MAX)
+		return poll;
+
+	now = now_ms();
+
+	if (now < log->next_deadline) {
+		if (poll >= 0 && poll < log->next_deadline - now)
+			return poll;
+		return log->next_deadline - now;
+	}
+
+	for (f = log->list; f != NULL; f = f->next) {
+		if (f->pending > 0) {
+			if (f->sync_due <= now) {
+				file_backend_sync_now(log, f);
+			} else if (f->sync_due < next) {
+				next = f->sync_due;
+			}
+		}
+
+		if (f->used > 0) {
+			if (f->flush_due <= now) {
+				file_backend_flush(log, f);
+			} else if (f->flush_due < next) {
+				next = f->flush_due;
+			}
+		}
+	}
+
+	log->next_deadline = next;
+
+	/* submit what the deadlines above have queued */
+	if (file_backend_complete(log))
+		poll = URING_POLL_INTERVAL;
+
+	if (next == LLONG_MAX)
+		return poll;
+	if (poll >= 0 && poll < next - now)
+		return poll;
+	return next - now;
+}
+
+static void file_backend_stream_stats(log_backend_t *backend,
+				      log_stream_fn fn, void *user)
+{
+	log_backend_file_t *log = (log_backend_file_t *)backend;
+	logfile_t *f;
+
+	for (f = log->list; f != NULL; f = f->next)
+		fn(user, f->filename, f->namelen, f->messages, f->bytes);
 }
 
 log_backend_file_t filebackend = {
@@ -219,8 +1401,40 @@ log_backend_file_t filebackend = {
 		.cleanup = file_backend_cleanup,
 		.write = file_backend_write,
 		.rotate = file_backend_rotate,
+		.tick = file_backend_tick,
+		.stream_stats = file_backend_stream_stats,
+	},
+	.list = NULL,
+};
+
+log_backend_file_t uringbackend = {
+	.base = {
+		.init = file_backend_init,
+		.cleanup = file_backend_cleanup,
+		.write = file_backend_write,
+		.rotate = file_backend_rotate,
+		.tick = file_backend_tick,
+		.stream_stats = file_backend_stream_stats,
 	},
 	.list = NULL,
+	.want_uring = true,
 };
 
 log_backend_t *logmgr = (log_backend_t *)&filebackend;
+
+log_backend_t *log_backend_by_name(const char *name)
+{
+	if (strcmp(name, "file") == 0)
+		return (log_backend_t *)&filebackend;
+
+	if (strcmp(name, "uring") == 0)
+		return (log_backend_t *)&uringbackend;
+
+	if (strcmp(name, "store") == 0)
+		return store_backend;
+
+	if (strcmp(name, "forward") == 0)
+		return forward_backend;
+
+	return NULL;
+}
@@ -0,0 +1,498 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "syslogd.h"
+
+static const char *log_dir = SYSLOG_PATH;
+static const char *ident_filter = NULL;
+static int64_t since = INT64_MIN;
+static int64_t until = INT64_MAX;
+static int facility = -1;
+static int level = SYSLOG_NUM_LEVELS - 1;
+
+/* idents of the segment being read, indexed by ID - 1 */
+static char **idents = NULL;
+static size_t ident_count = 0;
+static size_t ident_max = 0;
+
+/* ID of ident_filter in the segment being read, 0 if not seen yet */
+static uint32_t target = 0;
+
+static char block[STORE_BLOCK_SIZE];
+
+static const struct option options[] = {
+	{ "help", no_argument, NULL, 'h' },
+	{ "version", no_argument, NULL, 'V' },
+	{ "dir", required_argument, NULL, 'd' },
+	{ "since", required_argument, NULL, 's' },
+	{ "until", required_argument, NULL, 'u' },
+	{ "ident", required_argument, NULL, 'i' },
+	{ "facility", required_argument, NULL, 'f' },
+	{ "level", required_argument, NULL, 'l' },
+	{ NULL, 0, NULL, 0 },
+};
+
+static const char *shortopt = "hVd:s:u:i:f:l:";
+
+static const char *helptext =
+"Usage: logquery [OPTION]...\n\n"
+"Print messages from the binary log store written by the usyslogd 'store'\n"
+"backend. The index of each segment is used to only read the blocks that\n"
+"can contain matching messages.\n"
+"\n"
+"The following OPTIONSs can be used:\n"
+"  -d, --dir <path>           Log directory. Default is \"" SYSLOG_PATH "\".\n"
+"  -s, --since <time>         Only print messages from this time on.\n"
+"  -u, --until <time>         Only print messages before this time.\n"
+"  -i, --ident <name>         Only print messages with this ident.\n"
+"  -f, --facility <facility>  Only print messages with this facility.\n"
+"  -l, --level <level>        Only print messages with this level or a\n"
+"                             more severe one.\n"
+"  -h, --help                 Print this help text and exit\n"
+"  -V, --version              Print version information and exit\n\n"
+"Times are in UTC, in the form YYYY-MM-DD[THH:MM[:SS]] as printed in the\n"
+"log files, or a number of seconds since the epoch prefixed by '@'.\n";
+
+static const char *version_string =
+"logquery (usyslog) " PACKAGE_VERSION "\n"
+"Copyright (C) 2018 David Oberhollenzer\n\n"
+"This is free software: you are free to change and redistribute it.\n"
+"There is NO WARRANTY, to the extent permitted by law.\n";
+
+static int parse_time(const char *str, int64_t *out)
+{
+	static const char *formats[] = {
+		"%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M:%S",
+		"%Y-%m-%d %H:%M", "%Y-%m-%d",
+	};
+	const char *end;
+	struct tm tm;
+	size_t i;
+	char *ep;
+
+	if (*str == '@') {
+		*out = strtoll(str + 1, &ep, 10);
+		return (ep == str + 1 || *ep != '\0') ? -1 : 0;
+	}
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+		memset(&tm, 0, sizeof(tm));
+		end = strptime(str, formats[i], &tm);
+		if (end != NULL && *end == '\0') {
+			*out = timegm(&tm);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int parse_id(const char *str, int (*from_string)(const char *),
+		    int max)
+{
+	char *end;
+	long x;
+
+	if (isdigit(*str)) {
+		x = strtol(str, &end, 10);
+		return (*end != '\0' || x >= max) ? -1 : x;
+	}
+
+	return from_string(str);
+}
+
+static void process_options(int argc, char **argv)
+{
+	int c;
+
+	for (;;) {
+		c = getopt_long(argc, argv, shortopt, options, NULL);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'd':
+			log_dir = optarg;
+			break;
+		case 's':
+		case 'u':
+			if (parse_time(optarg, c == 's' ? &since : &until)) {
+				fprintf(stderr, "Cannot parse time '%s'\n",
+					optarg);
+				goto fail;
+			}
+			break;
+		case 'i':
+			ident_filter = optarg;
+			break;
+		case 'f':
+			facility = parse_id(optarg, facility_id_from_string,
+					    SYSLOG_NUM_FACILITIES);
+			if (facility < 0) {
+				fprintf(stderr, "Unknown facility '%s'\n",
+					optarg);
+				goto fail;
+			}
+			break;
+		case 'l':
+			level = parse_id(optarg, level_id_from_string,
+					 SYSLOG_NUM_LEVELS);
+			if (level < 0) {
+				fprintf(stderr, "Unknown log level '%s'\n",
+					optarg);
+				goto fail;
+			}
+			break;
+		case 'h':
+			fputs(helptext, stdout);
+			exit(EXIT_SUCCESS);
+		case 'V':
+			fputs(version_string, stdout);
+			exit(EXIT_SUCCESS);
+		default:
+			goto fail;
+		}
+	}
+
+	if (optind < argc) {
+		fputs("Unknown extra arguments\n", stderr);
+		goto fail;
+	}
+	return;
+fail:
+	fputs("Try `logquery --help' for more information\n", stderr);
+	exit(EXIT_FAILURE);
+}
+
+/*****************************************************************************/
+
+static void idents_reset(void)
+{
+	size_t i;
+
+	for (i = 0; i < ident_count; ++i)
+		free(idents[i]);
+
+	ident_count = 0;
+	target = 0;
+}
+
+/* IDs are assigned in order, so anything else is a duplicate or garbage. */
+static void ident_define(uint32_t id, const char *name, size_t length)
+{
+	char **new;
+
+	if (id != ident_count + 1)
+		return;
+
+	if (ident_count == ident_max) {
+		new = realloc(idents, (ident_max ? ident_max * 2 : 64) *
+			      sizeof(idents[0]));
+		if (new == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		idents = new;
+		ident_max = ident_max ? ident_max * 2 : 64;
+	}
+
+	idents[ident_count] = strndup(name, length);
+	if (idents[ident_count] == NULL) {
+		perror("strndup");
+		exit(EXIT_FAILURE);
+	}
+
+	ident_count += 1;
+
+	if (ident_filter != NULL && strlen(ident_filter) == length &&
+	    memcmp(ident_filter, name, length) == 0) {
+		target = id;
+	}
+}
+
+static bool record_valid(const store_record_t *rec, size_t remaining)
+{
+	if (remaining < sizeof(*rec) || rec->size < sizeof(*rec) ||
+	    rec->size % 8 != 0 || rec->size > remaining) {
+		return false;
+	}
+
+	if (rec->length > rec->size - sizeof(*rec))
+		return false;
+
+	return rec->facility == STORE_IDENT_RECORD ||
+		(rec->facility < SYSLOG_NUM_FACILITIES &&
+		 rec->level < SYSLOG_NUM_LEVELS);
+}
+
+static bool record_matches(const store_record_t *rec)
+{
+	if (rec->timestamp < since || rec->timestamp >= until)
+		return false;
+
+	if (facility >= 0 && rec->facility != facility)
+		return false;
+
+	if (rec->level > level)
+		return false;
+
+	return ident_filter == NULL || (target != 0 && rec->ident == target);
+}
+
+static void record_print(const store_record_t *rec)
+{
+	char prefix[FORMAT_PREFIX_MAX];
+	syslog_msg_t msg;
+	size_t len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.facility = rec->facility;
+	msg.level = rec->level;
+	msg.timestamp = rec->timestamp;
+	msg.pid = rec->pid;
+
+	if (rec->ident > 0 && rec->ident <= ident_count)
+		msg.ident = idents[rec->ident - 1];
+
+	len = format_prefix(prefix, &msg, true);
+
+	if (msg.ident != NULL) {
+		printf("%.*s%s: %.*s\n", (int)len, prefix, msg.ident,
+		       (int)rec->length, (const char *)(rec + 1));
+	} else {
+		printf("%.*s%.*s\n", (int)len, prefix, (int)rec->length,
+		       (const char *)(rec + 1));
+	}
+}
+
+/*
+  Print the matching records of a block. Returns the number of bytes
+  that contain intact records, which is less than the size for a torn
+  record at the end of a segment that is still being written.
+ */
+static size_t scan_block(const char *data, size_t size)
+{
+	const store_record_t *rec;
+	size_t offset = 0;
+
+	while (offset < size) {
+		rec = (const store_record_t *)(data + offset);
+
+		if (!record_valid(rec, size - offset))
+			break;
+
+		if (rec->facility == STORE_IDENT_RECORD) {
+			ident_define(rec->ident, (const char *)(rec + 1),
+				     rec->length);
+		} else if (record_matches(rec)) {
+			record_print(rec);
+		}
+
+		offset += rec->size;
+	}
+
+	return offset;
+}
+
+static bool block_wanted(const store_idx_block_t *blk)
+{
+	if (blk->count == 0)
+		return false;
+
+	if (blk->max_time < since || blk->min_time >= until)
+		return false;
+
+	if (ident_filter == NULL)
+		return true;
+
+	return target != 0 && (blk->ident_mask & (1ULL << (target % 64)));
+}
+
+static int read_block(int fd, const char *name, uint64_t offset, size_t size)
+{
+	ssize_t ret;
+
+	ret = pread(fd, block, size, offset);
+	if (ret < 0) {
+		perror(name);
+		return -1;
+	}
+
+	return ret;
+}
+
+static int query_segment(unsigned int segment)
+{
+	char seg_name[64], idx_name[64];
+	const store_idx_block_t *blk;
+	const store_idx_entry_t *ent;
+	const store_idx_ident_t *id;
+	const store_header_t *hdr;
+	uint64_t tail = sizeof(store_header_t);
+	int idx_fd, seg_fd = -1, ret = -1;
+	size_t offset, size = 0;
+	char *map = NULL;
+	struct stat sb;
+	ssize_t count;
+
+	snprintf(seg_name, sizeof(seg_name), "store.%08u.seg", segment);
+	snprintf(idx_name, sizeof(idx_name), "store.%08u.idx", segment);
+
+	idx_fd = open(idx_name, O_RDONLY | O_CLOEXEC);
+	if (idx_fd < 0 || fstat(idx_fd, &sb)) {
+		perror(idx_name);
+		goto out;
+	}
+
+	size = sb.st_size;
+	if (size < sizeof(*hdr)) {
+		fprintf(stderr, "%s: truncated index\n", idx_name);
+		goto out;
+	}
+
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, idx_fd, 0);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		perror(idx_name);
+		goto out;
+	}
+
+	hdr = (const store_header_t *)map;
+	if (memcmp(hdr->magic, STORE_IDX_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->version != STORE_VERSION) {
+		fprintf(stderr, "%s: not a log store index\n", idx_name);
+		goto out;
+	}
+
+	/* a sealed segment can be skipped entirely based on its header */
+	if ((hdr->flags & STORE_SEALED) &&
+	    (hdr->blocks == 0 || hdr->max_time < since ||
+	     hdr->min_time >= until)) {
+		ret = 0;
+		goto out;
+	}
+
+	seg_fd = open(seg_name, O_RDONLY | O_CLOEXEC);
+	if (seg_fd < 0) {
+		perror(seg_name);
+		goto out;
+	}
+
+	idents_reset();
+
+	for (offset = sizeof(*hdr); offset + sizeof(*ent) <= size;
+	     offset += ent->size) {
+		ent = (const store_idx_entry_t *)(map + offset);
+
+		if (ent->size < sizeof(*ent) || ent->size % 8 != 0 ||
+		    ent->size > size - offset) {
+			break;
+		}
+
+		if (ent->type == STORE_IDX_IDENT &&
+		    ent->size >= sizeof(*id)) {
+			id = (const store_idx_ident_t *)ent;
+			if (id->length <= ent->size - sizeof(*id)) {
+				ident_define(id->id, (const char *)(id + 1),
+					     id->length);
+			}
+			continue;
+		}
+
+		if (ent->type != STORE_IDX_BLOCK || ent->size < sizeof(*blk))
+			continue;
+
+		blk = (const store_idx_block_t *)ent;
+		if (blk->length > STORE_BLOCK_SIZE)
+			continue;
+
+		tail = blk->offset + blk->length;
+
+		/* a sealed index lists all idents before the first block */
+		if (!block_wanted(blk))
+			continue;
+
+		count = read_block(seg_fd, seg_name, blk->offset, blk->length);
+		if (count < 0)
+			goto out;
+
+		scan_block(block, count);
+	}
+
+	/*
+	  Records after the last indexed block are still being written to
+	  an unsealed segment. There is at most a block worth of them.
+	 */
+	if (!(hdr->flags & STORE_SEALED)) {
+		count = read_block(seg_fd, seg_name, tail, STORE_BLOCK_SIZE);
+		if (count < 0)
+			goto out;
+
+		scan_block(block, count);
+	}
+
+	ret = 0;
+out:
+	if (map != NULL)
+		munmap(map, size);
+	if (seg_fd >= 0)
+		close(seg_fd);
+	if (idx_fd >= 0)
+		close(idx_fd);
+	return ret;
+}
+
+static int segment_filter(const struct dirent *ent)
+{
+	unsigned int n;
+	char ext[4];
+
+	return sscanf(ent->d_name, "store.%u.%3s", &n, ext) == 2 &&
+		strcmp(ext, "seg") == 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i, count, status = EXIT_SUCCESS;
+	struct dirent **list;
+	unsigned int n;
+
+	process_options(argc, argv);
+
+	if (chdir(log_dir)) {
+		fprintf(stderr, "cd %s: %s\n", log_dir, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	/* zero padded numbers, so alphabetical order is creation order */
+	count = scandir(".", &list, segment_filter, alphasort);
+	if (count < 0) {
+		perror(log_dir);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (sscanf(list[i]->d_name, "store.%u", &n) == 1 &&
+		    query_segment(n) != 0) {
+			status = EXIT_FAILURE;
+		}
+		free(list[i]);
+	}
+
+	free(list);
+	idents_reset();
+	free(idents);
+	return status;
+}
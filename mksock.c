@@ -11,11 +11,16 @@
 
 #include "syslogd.h"
 
-int mksock(const char *path)
+int mksock(const char *path, int rcvbuf, bool passcred)
 {
 	struct sockaddr_un un;
 	const char *errmsg;
-	int fd;
+	int fd, one = 1;
+
+	if (strlen(path) >= sizeof(un.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return -1;
+	}
 
 	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
 	if (fd < 0) {
@@ -23,6 +28,25 @@ int mksock(const char *path)
 		return -1;
 	}
 
+	/* SO_RCVBUFFORCE ignores rmem_max, but needs CAP_NET_ADMIN */
+	if (rcvbuf > 0 &&
+	    setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		       &rcvbuf, sizeof(rcvbuf)) != 0 &&
+	    setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+		       &rcvbuf, sizeof(rcvbuf)) != 0) {
+		errmsg = "setting receive buffer size";
+		goto fail_errno;
+	}
+
+	/* not fatal, the drop counter is purely informational */
+	setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+
+	if (passcred &&
+	    setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) != 0) {
+		errmsg = "enabling SO_PASSCRED";
+		goto fail_errno;
+	}
+
 	memset(&un, 0, sizeof(un));
 	un.sun_family = AF_UNIX;
 
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: ISC */
 #include <stddef.h>
 #include <string.h>
+#include <limits.h>
 #include <ctype.h>
 #include <time.h>
 
@@ -14,6 +15,23 @@ static const char *months[] = {
 
 static const int days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
 
+/*
+  Information about the local time, refreshed by syslog_clock_update().
+  The UTC offset is known to be constant in [valid_from, valid_until],
+  so local time stamps in that range can be converted arithmetically.
+ */
+static struct {
+	bool initialized;
+	time_t now;
+	time_t last;
+	time_t refresh;
+	int year;
+	int month;
+	long utc_offset;
+	time_t valid_from;
+	time_t valid_until;
+} clk;
+
 static int isleap(int year)
 {
 	return ((year % 4 == 0) && (year % 100 != 0)) || ((year % 400) == 0);
@@ -26,6 +44,67 @@ static int mdays(int year, int month)
 	return (isleap(year) && month == 2) ? 29 : days[month - 1];
 }
 
+static bool get_utc_offset(time_t t, struct tm *tm, long *offset)
+{
+	if (localtime_r(&t, tm) == NULL)
+		return false;
+
+	*offset = tm->tm_gmtoff;
+	return true;
+}
+
+void syslog_clock_update(time_t now)
+{
+	long before, after;
+	struct tm tm;
+
+	clk.now = now;
+
+	if (clk.initialized && now >= clk.last && now < clk.refresh)
+		return;
+
+	clk.initialized = false;
+
+	if (!get_utc_offset(now, &tm, &clk.utc_offset))
+		return;
+
+	clk.year = tm.tm_year;
+	clk.month = tm.tm_mon;
+	clk.last = now;
+
+	/* refresh at the start of the next local minute */
+	clk.refresh = now + 60 - tm.tm_sec;
+
+	if (!get_utc_offset(now - 3600, &tm, &before))
+		return;
+	if (!get_utc_offset(clk.refresh + 60, &tm, &after))
+		return;
+
+	if (before == clk.utc_offset && after == clk.utc_offset) {
+		clk.valid_from = now - 3600;
+		clk.valid_until = clk.refresh + 60;
+	} else {
+		/* close to a DST transition, always use mktime */
+		clk.valid_from = 0;
+		clk.valid_until = -1;
+	}
+
+	clk.initialized = true;
+}
+
+/* number of days since 1970-01-01 in the proleptic Gregorian calendar */
+static long days_from_civil(long year, int month, int day)
+{
+	long era, yoe, doy, doe;
+
+	year -= month <= 2;
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
 static char *read_num(char *str, int *out, int maxval)
 {
 	if (str == NULL || !isdigit(*str))
@@ -47,9 +126,30 @@ static char *skip_space(char *str)
 	return str;
 }
 
-static char *read_date_bsd(char *str, struct tm *tm)
+/* time used for messages without a time stamp */
+static time_t clock_now(void)
+{
+	return clk.initialized ? clk.now : time(NULL);
+}
+
+/* Check if a string starts like "Oct 16", i.e. a BSD style date. */
+static bool is_date_bsd(const char *str)
+{
+	if (!isalpha(str[0]) || !isalpha(str[1]) || !isalpha(str[2]))
+		return false;
+	if (str[3] != ' ')
+		return false;
+
+	for (str += 4; *str == ' '; ++str)
+		;
+
+	return isdigit(*str);
+}
+
+static char *read_date_bsd(char *str, time_t *out)
 {
 	int year, month, day, hour, minute, second;
+	struct tm tm;
 	time_t t;
 
 	/* decode date */
@@ -63,16 +163,18 @@ static char *read_date_bsd(char *str, struct tm *tm)
 	str = read_num(str, &day, 31);
 	str = skip_space(str);
 
-	t = time(NULL);
-	if (localtime_r(&t, tm) == NULL)
-		return NULL;
+	if (!clk.initialized) {
+		syslog_clock_update(time(NULL));
+		if (!clk.initialized)
+			return NULL;
+	}
 
-	year = tm->tm_year;
+	year = clk.year;
 
 	/* sanity check */
 	if (str == NULL || month >= 12 || day < 1)
 		return NULL;
-	if (month == 11 && tm->tm_mon == 0)
+	if (month == 11 && clk.month == 0)
 		--year;
 	if (day > mdays(year + 1900, month + 1))
 		return NULL;
@@ -87,14 +189,86 @@ static char *read_date_bsd(char *str, struct tm *tm)
 	str = read_num(str, &second, 59);
 	str = skip_space(str);
 
-	/* store result */
-	memset(tm, 0, sizeof(*tm));
-	tm->tm_sec = second;
-	tm->tm_min = minute;
-	tm->tm_hour = hour;
-	tm->tm_mday = day;
-	tm->tm_mon = month;
-	tm->tm_year = year;
+	/* convert to UTC */
+	t = days_from_civil(year + 1900, month + 1, day) * 86400L +
+		hour * 3600L + minute * 60L + second - clk.utc_offset;
+
+	if (t < clk.valid_from || t > clk.valid_until) {
+		memset(&tm, 0, sizeof(tm));
+		tm.tm_sec = second;
+		tm.tm_min = minute;
+		tm.tm_hour = hour;
+		tm.tm_mday = day;
+		tm.tm_mon = month;
+		tm.tm_year = year;
+		tm.tm_isdst = -1;
+		t = mktime(&tm);
+	}
+
+	*out = t;
+	return str;
+}
+
+/*
+  Decode an RFC 3339 time stamp, e.g. "2026-10-16T10:00:00.123+02:00".
+  Fractional seconds are accepted but ignored.
+ */
+static char *read_date_rfc3339(char *str, time_t *out)
+{
+	int year, month, day, hour, minute, second, oh, om;
+	long offset = 0;
+	char sign;
+
+	str = read_num(str, &year, 9999);
+	if (str == NULL || *(str++) != '-')
+		return NULL;
+	str = read_num(str, &month, 12);
+	if (str == NULL || *(str++) != '-' || month < 1)
+		return NULL;
+	str = read_num(str, &day, 31);
+	if (str == NULL || day < 1 || day > mdays(year, month))
+		return NULL;
+	if (*str != 'T' && *str != 't')
+		return NULL;
+
+	str = read_num(str + 1, &hour, 23);
+	if (str == NULL || *(str++) != ':')
+		return NULL;
+	str = read_num(str, &minute, 59);
+	if (str == NULL || *(str++) != ':')
+		return NULL;
+
+	/* allow for leap seconds */
+	str = read_num(str, &second, 60);
+	if (str == NULL)
+		return NULL;
+
+	if (*str == '.') {
+		if (!isdigit(*(++str)))
+			return NULL;
+		while (isdigit(*str))
+			++str;
+	}
+
+	if (*str == 'Z' || *str == 'z') {
+		++str;
+	} else if (*str == '+' || *str == '-') {
+		sign = *(str++);
+		str = read_num(str, &oh, 23);
+		if (str == NULL || *(str++) != ':')
+			return NULL;
+		str = read_num(str, &om, 59);
+		if (str == NULL)
+			return NULL;
+		offset = oh * 3600L + om * 60L;
+		if (sign == '-')
+			offset = -offset;
+	} else {
+		return NULL;
+	}
+
+	*out = days_from_civil(year, month, day) * 86400L + hour * 3600L +
+		minute * 60L + second - offset;
 	return str;
 }
 
@@ -112,13 +286,187 @@ static char *decode_priority(char *str, int *priority)
 	return str;
 }
 
-int syslog_msg_parse(syslog_msg_t *msg, char *str)
+static pid_t decode_pid(const char *str)
 {
-	char *ident, *ptr;
-	struct tm tstamp;
 	pid_t pid = 0;
+
+	while (isdigit(*str)) {
+		if (pid > (INT_MAX - 9) / 10)
+			return 0;
+		pid = pid * 10 + *(str++) - '0';
+	}
+
+	return pid;
+}
+
+/*
+  Split off a space terminated RFC 5424 header field. The field is set
+  to NULL if it is the NILVALUE "-".
+ */
+static char *read_field(char *str, char **field)
+{
+	char *end = str;
+
+	while (*end != ' ' && *end != '\0')
+		++end;
+
+	if (*end != ' ' || end == str)
+		return NULL;
+
+	*end = '\0';
+	*field = (end - str == 1 && *str == '-') ? NULL : str;
+	return end + 1;
+}
+
+/*
+  Find the end of the RFC 5424 structured data, i.e. either the NILVALUE
+  or a sequence of "[id name="value" ...]" elements. Within quoted
+  values, '"', '\\' and ']' may be escaped with a backslash.
+ */
+static char *read_sdata(char *str, const char **out)
+{
+	char *start = str;
+
+	if (*str == '-') {
+		*out = NULL;
+		return str + 1;
+	}
+
+	if (*str != '[')
+		return NULL;
+
+	while (*str == '[') {
+		for (;;) {
+			str = scan_delim(str + 1, '"', ']');
+			if (*str == ']')
+				break;
+			if (*str == '\0')
+				return NULL;
+
+			/* skip over the quoted value */
+			for (;;) {
+				str = scan_delim(str + 1, '"', '\\');
+				if (*str == '"')
+					break;
+				if (*str == '\0' || str[1] == '\0')
+					return NULL;
+				++str;
+			}
+		}
+
+		++str;
+	}
+
+	*out = start;
+	return str;
+}
+
+/*
+  <PRI>VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID SD [MSG]
+  with the <PRI> already decoded.
+ */
+static char *parse_rfc5424(syslog_msg_t *msg, char *str, char **ident)
+{
+	char *hostname, *procid, *msgid, *end;
+
+	while (isdigit(*str))
+		++str;
+	if (*(str++) != ' ')
+		return NULL;
+
+	if (str[0] == '-' && str[1] == ' ') {
+		msg->timestamp = clock_now();
+		str += 2;
+	} else {
+		str = read_date_rfc3339(str, &msg->timestamp);
+		if (str == NULL || *(str++) != ' ')
+			return NULL;
+	}
+
+	if ((str = read_field(str, &hostname)) == NULL)
+		return NULL;
+	if ((str = read_field(str, ident)) == NULL)
+		return NULL;
+	if ((str = read_field(str, &procid)) == NULL)
+		return NULL;
+	if ((str = read_field(str, &msgid)) == NULL)
+		return NULL;
+
+	end = read_sdata(str, &msg->sdata);
+	if (end == NULL)
+		return NULL;
+
+	if (*end == ' ') {
+		*(end++) = '\0';
+	} else if (*end != '\0') {
+		return NULL;
+	}
+
+	/* the message may start with a UTF-8 byte order mark */
+	if ((unsigned char)end[0] == 0xEF && (unsigned char)end[1] == 0xBB &&
+	    (unsigned char)end[2] == 0xBF) {
+		end += 3;
+	}
+
+	if (procid != NULL)
+		msg->pid = decode_pid(procid);
+
+	msg->hostname = hostname;
+	msg->msgid = msgid;
+	return end;
+}
+
+/*
+  [TIMESTAMP] [TAG[\[PID\]]:] MSG with the <PRI> already decoded. The time
+  stamp is either BSD style, RFC 3339 or missing entirely.
+ */
+static char *parse_rfc3164(syslog_msg_t *msg, char *str, char **out)
+{
+	char *ident, *ptr;
+
+	/* text that merely starts with a digit has no time stamp */
+	if (isdigit(*str) && (ptr = read_date_rfc3339(str, &msg->timestamp)) &&
+	    isspace(*ptr)) {
+		str = ptr;
+		while (isspace(*str))
+			++str;
+	} else if (is_date_bsd(str)) {
+		str = read_date_bsd(str, &msg->timestamp);
+		if (str == NULL)
+			return NULL;
+	} else {
+		msg->timestamp = clock_now();
+	}
+
+	ident = str;
+	str = scan_delim(str, ':', ':');
+
+	if (*str != ':')
+		return ident;
+
+	*(str++) = '\0';
+	while (isspace(*str))
+		++str;
+
+	ptr = scan_delim(ident, '[', '[');
+
+	if (*ptr == '[') {
+		*(ptr++) = '\0';
+		msg->pid = decode_pid(ptr);
+	}
+
+	if (ident[0] != '\0')
+		*out = ident;
+
+	return str;
+}
+
+int syslog_msg_parse(syslog_msg_t *msg, char *str)
+{
+	char *ident = NULL, *ptr;
+	uint32_t hash;
 	int priority;
-	size_t len;
+	size_t i, len;
 
 	memset(msg, 0, sizeof(*msg));
 
@@ -129,51 +477,52 @@ int syslog_msg_parse(syslog_msg_t *msg, char *str)
 	msg->facility = priority >> 3;
 	msg->level = priority & 0x07;
 
-	str = read_date_bsd(str, &tstamp);
-	if (str == NULL)
-		return -1;
-
-	ident = str;
-	while (*str != '\0' && *str != ':')
-		++str;
-
-	if (*str == ':') {
-		*(str++) = '\0';
-		while (isspace(*str))
-			++str;
-
-		ptr = ident;
-		while (*ptr != '[' && *ptr != '\0')
-			++ptr;
+	if (isdigit(str[0]) &&
+	    (str[1] == ' ' || (isdigit(str[1]) && str[2] == ' '))) {
+		len = strlen(str);
+		ptr = parse_rfc5424(msg, str, &ident);
 
-		if (*ptr == '[') {
-			*(ptr++) = '\0';
+		/*
+		  Not an RFC 5424 header after all, but text without a time
+		  stamp or tag that starts with a number. Undo the fields
+		  split off so far and keep all of it as the message.
+		 */
+		if (ptr == NULL) {
+			for (i = 0; i < len; ++i) {
+				if (str[i] == '\0')
+					str[i] = ' ';
+			}
 
-			while (isdigit(*ptr))
-				pid = pid * 10 + *(ptr++) - '0';
+			msg->timestamp = clock_now();
+			msg->sdata = NULL;
+			ident = NULL;
+			ptr = str;
 		}
+
+		str = ptr;
 	} else {
-		ident = NULL;
+		str = parse_rfc3164(msg, str, &ident);
 	}
 
-	if (ident != NULL && ident[0] == '\0')
-		ident = NULL;
+	if (str == NULL)
+		return -1;
 
-	msg->timestamp = mktime(&tstamp);
-	msg->pid = pid;
-	msg->ident = ident;
 	msg->message = str;
 
-	len = strlen(str);
-	while (len > 0 && isspace(str[len - 1]))
-		--len;
+	len = scan_trim(str, strlen(str));
 	str[len] = '\0';
 
 	if (ident != NULL) {
+		hash = IDENT_HASH_INIT;
+
 		for (ptr = ident; *ptr != '\0'; ++ptr) {
 			if (!isalnum(*ptr))
 				*ptr = '_';
+			hash = IDENT_HASH_STEP(hash, *ptr);
 		}
+
+		msg->ident = ident;
+		msg->ident_hash = hash;
 	}
 
 	return 0;
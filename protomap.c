@@ -70,3 +70,13 @@ int facility_id_from_string(const char *fac)
 	}
 	return -1;
 }
+
+uint32_t ident_hash(const char *str)
+{
+	uint32_t hash = IDENT_HASH_INIT;
+
+	while (*str != '\0')
+		hash = IDENT_HASH_STEP(hash, *(str++));
+
+	return hash;
+}
@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: ISC */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "syslogd.h"
+
+/* bucket fill levels are kept in thousandths of a message */
+#define TOKEN_SCALE 1000LL
+
+int ratelimit_init(ratelimit_t *rl, unsigned int rate, unsigned int burst,
+		   bool by_uid)
+{
+	memset(rl, 0, sizeof(*rl));
+
+	rl->table = calloc(RATELIMIT_SETS * RATELIMIT_WAYS,
+			   sizeof(rl->table[0]));
+	if (rl->table == NULL) {
+		perror("allocating rate limit table");
+		return -1;
+	}
+
+	rl->rate = rate;
+	rl->burst = burst;
+	rl->by_uid = by_uid;
+	return 0;
+}
+
+void ratelimit_cleanup(ratelimit_t *rl)
+{
+	free(rl->table);
+	rl->table = NULL;
+}
+
+/*
+  Find the entry of a sender in its set, or replace the least recently
+  used one. Counts of not yet reported suppressed messages of a replaced
+  sender are kept in a separate counter.
+ */
+static ratelimit_entry_t *lookup(ratelimit_t *rl, uint32_t key)
+{
+	uint32_t set = (key * 2654435761U) & (RATELIMIT_SETS - 1);
+	ratelimit_entry_t *e = rl->table + set * RATELIMIT_WAYS;
+	ratelimit_entry_t *victim = e;
+	int i;
+
+	for (i = 0; i < RATELIMIT_WAYS; ++i) {
+		if (e[i].used && e[i].key == key)
+			return e + i;
+
+		if (!e[i].used) {
+			victim = e + i;
+			break;
+		}
+
+		if (e[i].last < victim->last)
+			victim = e + i;
+	}
+
+	rl->evicted_suppressed += victim->suppressed;
+
+	victim->used = true;
+	victim->key = key;
+	victim->tokens = rl->burst * TOKEN_SCALE;
+	victim->last = 0;
+	victim->suppressed = 0;
+	return victim;
+}
+
+bool ratelimit_check(ratelimit_t *rl, pid_t pid, uid_t uid, long long now)
+{
+	ratelimit_entry_t *e;
+	long long elapsed;
+
+	e = lookup(rl, rl->by_uid ? (uint32_t)uid : (uint32_t)pid);
+	e->pid = pid;
+	e->uid = uid;
+
+	/* rate is per second and now in milliseconds, i.e. rate * 1/1000 */
+	if (e->last > 0 && now > e->last) {
+		elapsed = now - e->last;
+
+		e->tokens += elapsed * rl->rate;
+		if (e->tokens > rl->burst * TOKEN_SCALE)
+			e->tokens = rl->burst * TOKEN_SCALE;
+	}
+
+	e->last = now;
+
+	if (e->tokens < TOKEN_SCALE) {
+		e->suppressed += 1;
+		return false;
+	}
+
+	e->tokens -= TOKEN_SCALE;
+	return true;
+}
+
+void ratelimit_report(ratelimit_t *rl, ratelimit_fn fn, void *user)
+{
+	ratelimit_entry_t *e;
+	size_t i;
+
+	for (i = 0; i < RATELIMIT_SETS * RATELIMIT_WAYS; ++i) {
+		e = rl->table + i;
+
+		if (e->suppressed > 0) {
+			fn(user, e, e->suppressed);
+			e->suppressed = 0;
+		}
+	}
+
+	if (rl->evicted_suppressed > 0) {
+		fn(user, NULL, rl->evicted_suppressed);
+		rl->evicted_suppressed = 0;
+	}
+}
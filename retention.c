@@ -0,0 +1,426 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "syslogd.h"
+
+#define STREAM_BUCKETS 256
+
+/* rotated files are named <stream>.log.<suffix> */
+#define ROTATED_MARK ".log."
+
+typedef struct archive_t {
+	/* the next newer file of the stream */
+	struct archive_t *next;
+
+	time_t mtime;
+	uint64_t size;
+	char name[];
+} archive_t;
+
+typedef struct stream_t {
+	struct stream_t *next;
+	uint32_t hash;
+
+	/* rotated files, oldest first */
+	archive_t *oldest;
+	archive_t *newest;
+	size_t count;
+	uint64_t bytes;
+
+	/* the file name up to and including ROTATED_MARK */
+	size_t len;
+	char name[];
+} stream_t;
+
+static retention_t limits;
+static stream_t *table[STREAM_BUCKETS];
+
+/* size of all rotated files, mirrored in stats.rotated_bytes */
+static uint64_t total = 0;
+
+static bool enabled(void)
+{
+	return limits.count > 0 || limits.max_age > 0 || limits.bytes > 0 ||
+		limits.budget > 0;
+}
+
+static void account(int64_t delta)
+{
+	total += delta;
+	STATS_ADD(stats.rotated_bytes, delta);
+}
+
+/* Returns the length of the stream part of a name, or 0 if not rotated. */
+static size_t stream_length(const char *name)
+{
+	const char *ptr, *last = NULL;
+
+	for (ptr = name; (ptr = strstr(ptr, ROTATED_MARK)) != NULL; ++ptr)
+		last = ptr;
+
+	return last == NULL ? 0 : (last - name) + strlen(ROTATED_MARK);
+}
+
+static bool has_suffix(const char *name, const char *suffix)
+{
+	size_t len = strlen(name), slen = strlen(suffix);
+
+	return len >= slen && strcmp(name + len - slen, suffix) == 0;
+}
+
+static stream_t *stream_get(const char *name, size_t len)
+{
+	char *key = alloca(len + 1);
+	uint32_t hash;
+	stream_t *s;
+
+	memcpy(key, name, len);
+	key[len] = '\0';
+	hash = ident_hash(key);
+
+	for (s = table[hash % STREAM_BUCKETS]; s != NULL; s = s->next) {
+		if (s->hash == hash && s->len == len &&
+		    memcmp(s->name, key, len) == 0) {
+			return s;
+		}
+	}
+
+	s = calloc(1, sizeof(*s) + len + 1);
+	if (s == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+
+	memcpy(s->name, key, len + 1);
+	s->len = len;
+	s->hash = hash;
+	s->next = table[hash % STREAM_BUCKETS];
+	table[hash % STREAM_BUCKETS] = s;
+	return s;
+}
+
+static archive_t *archive_create(const char *name, const struct stat *sb)
+{
+	size_t len = strlen(name);
+	archive_t *a;
+
+	a = calloc(1, sizeof(*a) + len + 1);
+	if (a == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+
+	memcpy(a->name, name, len);
+	a->mtime = sb->st_mtime;
+	a->size = sb->st_size;
+	return a;
+}
+
+/* Unlink a file from the list, given its predecessor (NULL for the first). */
+static void stream_unlink(stream_t *s, archive_t *prev, archive_t *a)
+{
+	if (prev == NULL) {
+		s->oldest = a->next;
+	} else {
+		prev->next = a->next;
+	}
+
+	if (s->newest == a)
+		s->newest = prev;
+
+	s->count -= 1;
+	s->bytes -= a->size;
+	account(-(int64_t)a->size);
+}
+
+/* A file that is replaced by a rename is no longer there. */
+static void stream_forget(stream_t *s, const char *name)
+{
+	archive_t *a, *prev = NULL;
+
+	for (a = s->oldest; a != NULL; prev = a, a = a->next) {
+		if (strcmp(a->name, name) == 0) {
+			stream_unlink(s, prev, a);
+			free(a);
+			return;
+		}
+	}
+}
+
+/* Insert a file ordered by modification time, for the initial scan. */
+static void stream_insert(stream_t *s, archive_t *a)
+{
+	archive_t *it, *prev = NULL;
+
+	for (it = s->oldest; it != NULL; prev = it, it = it->next) {
+		if (a->mtime < it->mtime ||
+		    (a->mtime == it->mtime && strcmp(a->name, it->name) < 0)) {
+			break;
+		}
+	}
+
+	a->next = it;
+	if (prev == NULL) {
+		s->oldest = a;
+	} else {
+		prev->next = a;
+	}
+
+	if (it == NULL)
+		s->newest = a;
+
+	s->count += 1;
+	s->bytes += a->size;
+	account(a->size);
+}
+
+static void stream_append(stream_t *s, archive_t *a)
+{
+	if (s->newest == NULL) {
+		s->oldest = a;
+	} else {
+		s->newest->next = a;
+	}
+
+	s->newest = a;
+	s->count += 1;
+	s->bytes += a->size;
+	account(a->size);
+}
+
+static bool stream_over_limit(const stream_t *s, time_t now)
+{
+	if (s->oldest == NULL)
+		return false;
+
+	if (limits.count > 0 && s->count > limits.count)
+		return true;
+
+	if (limits.bytes > 0 && s->bytes > limits.bytes)
+		return true;
+
+	return limits.max_age > 0 &&
+		s->oldest->mtime + (time_t)limits.max_age <= now;
+}
+
+static void stream_remove_oldest(stream_t *s)
+{
+	archive_t *a = s->oldest;
+
+	stream_unlink(s, NULL, a);
+
+	if (unlink(a->name) == 0) {
+		STATS_ADD(stats.expired, 1);
+		STATS_ADD(stats.expired_bytes, a->size);
+	} else if (errno != ENOENT) {
+		perror(a->name);
+	}
+
+	free(a);
+}
+
+static void stream_enforce(stream_t *s, time_t now)
+{
+	while (stream_over_limit(s, now))
+		stream_remove_oldest(s);
+}
+
+/*
+  The space left by the live files is shared equally between the streams
+  that have rotated files. Of the streams using more than their share,
+  the one with the oldest file loses it, so a single noisy stream cannot
+  push out the history of all others.
+ */
+static stream_t *budget_victim(uint64_t live)
+{
+	uint64_t share, avail = limits.budget > live ? limits.budget - live : 0;
+	stream_t *s, *victim = NULL;
+	size_t i, streams = 0;
+
+	for (i = 0; i < STREAM_BUCKETS; ++i) {
+		for (s = table[i]; s != NULL; s = s->next)
+			streams += s->oldest != NULL;
+	}
+
+	if (streams == 0)
+		return NULL;
+
+	share = avail / streams;
+
+	for (i = 0; i < STREAM_BUCKETS; ++i) {
+		for (s = table[i]; s != NULL; s = s->next) {
+			if (s->oldest == NULL || s->bytes <= share)
+				continue;
+
+			if (victim == NULL ||
+			    s->oldest->mtime < victim->oldest->mtime) {
+				victim = s;
+			}
+		}
+	}
+
+	return victim;
+}
+
+void retention_init(const retention_t *cfg)
+{
+	limits = *cfg;
+}
+
+void retention_scan(bool compressed)
+{
+	struct dirent *ent;
+	struct stat sb;
+	stream_t *s;
+	archive_t *a;
+	size_t i, len;
+	DIR *dir;
+
+	if (!enabled())
+		return;
+
+	dir = opendir(".");
+	if (dir == NULL) {
+		perror("scanning for rotated log files");
+		return;
+	}
+
+	while ((ent = readdir(dir)) != NULL) {
+		len = stream_length(ent->d_name);
+		if (len == 0)
+			continue;
+
+		if (has_suffix(ent->d_name, ".tmp"))
+			continue;
+
+		/* uncompressed files are added once they are compressed */
+		if (compressed && !has_suffix(ent->d_name, ".gz") &&
+		    !has_suffix(ent->d_name, ".zst")) {
+			continue;
+		}
+
+		if (lstat(ent->d_name, &sb) != 0 || !S_ISREG(sb.st_mode))
+			continue;
+
+		s = stream_get(ent->d_name, len);
+		if (s == NULL)
+			break;
+
+		a = archive_create(ent->d_name, &sb);
+		if (a == NULL)
+			break;
+
+		stream_insert(s, a);
+	}
+
+	closedir(dir);
+
+	for (i = 0; i < STREAM_BUCKETS; ++i) {
+		for (s = table[i]; s != NULL; s = s->next)
+			stream_enforce(s, time(NULL));
+	}
+
+	retention_budget(__atomic_load_n(&stats.live_bytes, __ATOMIC_RELAXED));
+}
+
+void retention_add(const char *path)
+{
+	struct stat sb;
+	stream_t *s;
+	archive_t *a;
+	size_t len;
+
+	if (!enabled())
+		return;
+
+	len = stream_length(path);
+	if (len == 0 || stat(path, &sb) != 0)
+		return;
+
+	s = stream_get(path, len);
+	if (s == NULL)
+		return;
+
+	a = archive_create(path, &sb);
+	if (a == NULL)
+		return;
+
+	/* with --rotate-replace, or two rotations within a second */
+	stream_forget(s, path);
+
+	stream_append(s, a);
+	stream_enforce(s, time(NULL));
+	retention_budget(__atomic_load_n(&stats.live_bytes, __ATOMIC_RELAXED));
+}
+
+time_t retention_expire(time_t now)
+{
+	time_t expires, next = 0;
+	stream_t *s;
+	size_t i;
+
+	if (limits.max_age == 0)
+		return 0;
+
+	for (i = 0; i < STREAM_BUCKETS; ++i) {
+		for (s = table[i]; s != NULL; s = s->next) {
+			stream_enforce(s, now);
+
+			if (s->oldest == NULL)
+				continue;
+
+			expires = s->oldest->mtime + limits.max_age;
+			if (next == 0 || expires < next)
+				next = expires;
+		}
+	}
+
+	return next;
+}
+
+void retention_budget(uint64_t live)
+{
+	stream_t *s;
+
+	if (limits.budget == 0)
+		return;
+
+	while (live + total > limits.budget) {
+		s = budget_victim(live);
+		if (s == NULL)
+			break;
+
+		stream_remove_oldest(s);
+	}
+}
+
+void retention_cleanup(void)
+{
+	stream_t *s;
+	archive_t *a;
+	size_t i;
+
+	for (i = 0; i < STREAM_BUCKETS; ++i) {
+		while (table[i] != NULL) {
+			s = table[i];
+			table[i] = s->next;
+
+			while (s->oldest != NULL) {
+				a = s->oldest;
+				s->oldest = a->next;
+				free(a);
+			}
+
+			free(s);
+		}
+	}
+
+	account(-(int64_t)total);
+}
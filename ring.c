@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/eventfd.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "syslogd.h"
+
+int msgring_init(msgring_t *ring, size_t count)
+{
+	size_t size = 1;
+
+	while (size < count)
+		size <<= 1;
+
+	memset(ring, 0, sizeof(*ring));
+
+	ring->slots = calloc(size, sizeof(ring->slots[0]));
+	if (ring->slots == NULL) {
+		perror("allocating message queue");
+		return -1;
+	}
+
+	ring->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ring->efd < 0) {
+		perror("eventfd");
+		free(ring->slots);
+		return -1;
+	}
+
+	ring->mask = size - 1;
+	return 0;
+}
+
+void msgring_cleanup(msgring_t *ring)
+{
+	close(ring->efd);
+	free(ring->slots);
+}
+
+size_t msgring_space(msgring_t *ring)
+{
+	size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	return ring->mask + 1 - (ring->head - tail);
+}
+
+msg_slot_t *msgring_producer_slot(msgring_t *ring, size_t i)
+{
+	return ring->slots + ((ring->head + i) & ring->mask);
+}
+
+void msgring_publish(msgring_t *ring, size_t count)
+{
+	uint64_t one = 1;
+	size_t fill;
+
+	__atomic_store_n(&ring->head, ring->head + count, __ATOMIC_RELEASE);
+
+	fill = ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (fill > ring->high_water)
+		__atomic_store_n(&ring->high_water, fill, __ATOMIC_RELAXED);
+
+	/* pairs with the fence in msgring_wait() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED)) {
+		if (write(ring->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			perror("eventfd write");
+	}
+}
+
+void msgring_drop(msgring_t *ring, size_t count)
+{
+	__atomic_fetch_add(&ring->drops, count, __ATOMIC_RELAXED);
+}
+
+size_t msgring_available(msgring_t *ring)
+{
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail;
+}
+
+msg_slot_t *msgring_consumer_slot(msgring_t *ring, size_t i)
+{
+	return ring->slots + ((ring->tail + i) & ring->mask);
+}
+
+void msgring_release(msgring_t *ring, size_t count)
+{
+	__atomic_store_n(&ring->tail, ring->tail + count, __ATOMIC_RELEASE);
+}
+
+bool msgring_wait(msgring_t *ring, int timeout, int fd)
+{
+	struct pollfd pfd[2];
+	bool ready = false;
+	uint64_t value;
+
+	__atomic_store_n(&ring->sleeping, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (msgring_available(ring) == 0) {
+		pfd[0].fd = ring->efd;
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		pfd[1].fd = fd;
+		pfd[1].events = POLLIN;
+		pfd[1].revents = 0;
+
+		if (poll(pfd, fd >= 0 ? 2 : 1, timeout) > 0) {
+			if ((pfd[0].revents & POLLIN) &&
+			    read(ring->efd, &value, sizeof(value)) < 0 &&
+			    errno != EAGAIN) {
+				perror("eventfd read");
+			}
+
+			ready = (pfd[1].revents & POLLIN) != 0;
+		}
+	}
+
+	__atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+	return ready;
+}
+
+size_t msgring_depth(msgring_t *ring)
+{
+	return __atomic_load_n(&ring->head, __ATOMIC_RELAXED) -
+		__atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+}
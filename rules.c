@@ -0,0 +1,630 @@
+/* SPDX-License-Identifier: ISC */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "syslogd.h"
+
+#define MAX_BACKENDS 8
+
+/* number of idents whose matching rules are cached, a power of two */
+#define IDENT_CACHE_SIZE 4096
+
+/* rules with an ident pattern tracked per cached ident */
+#define IDENT_CACHE_RULES 8
+
+#define MASK_WORDS ((SYSLOG_NUM_FACILITIES * SYSLOG_NUM_LEVELS + 63) / 64)
+
+typedef struct {
+	/* one bit for every facility and level combination matched */
+	uint64_t mask[MASK_WORDS];
+
+	/* glob pattern for the ident, NULL if any message matches */
+	char *ident;
+
+	/* backend to write to, NULL to drop the message */
+	log_backend_t *backend;
+
+	/* log stream name to use instead of the ident or facility */
+	char *stream;
+	uint32_t stream_hash;
+} rule_t;
+
+typedef struct {
+	uint32_t hash;
+
+	/*
+	  Indices of the rules with an ident pattern that matches, in
+	  ascending order. If there are more than IDENT_CACHE_RULES, count
+	  is larger and the rules have to be checked one by one.
+	 */
+	unsigned int count;
+	unsigned int rules[IDENT_CACHE_RULES];
+
+	char name[];
+} ident_entry_t;
+
+typedef struct {
+	rule_t *rules;
+	size_t count;
+
+	/*
+	  Index of the first rule without an ident pattern that matches
+	  each facility and level, or count if there is none.
+	 */
+	unsigned int table[SYSLOG_NUM_FACILITIES][SYSLOG_NUM_LEVELS];
+
+	/* open addressing hash table of idents seen so far */
+	ident_entry_t **cache;
+	size_t cache_count;
+	bool has_ident_rules;
+} ruleset_t;
+
+typedef struct {
+	log_backend_t base;
+
+	/* absolute path of the configuration file */
+	char *filename;
+
+	/* backend used for the "file" action */
+	log_backend_t *fallback;
+
+	/* backends that have been initialized */
+	log_backend_t *backends[MAX_BACKENDS];
+	size_t num_backends;
+
+	const log_config_t *cfg;
+	ruleset_t *rules;
+} log_backend_rules_t;
+
+static bool mask_test(const uint64_t *mask, int facility, int level)
+{
+	unsigned int bit = facility * SYSLOG_NUM_LEVELS + level;
+
+	return (mask[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void mask_set(uint64_t *mask, int facility, int level)
+{
+	unsigned int bit = facility * SYSLOG_NUM_LEVELS + level;
+
+	mask[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static void ruleset_free(ruleset_t *rs)
+{
+	size_t i;
+
+	if (rs == NULL)
+		return;
+
+	for (i = 0; i < rs->count; ++i) {
+		free(rs->rules[i].ident);
+		free(rs->rules[i].stream);
+	}
+
+	if (rs->cache != NULL) {
+		for (i = 0; i < IDENT_CACHE_SIZE; ++i)
+			free(rs->cache[i]);
+	}
+
+	free(rs->cache);
+	free(rs->rules);
+	free(rs);
+}
+
+/*****************************************************************************/
+
+static int parse_level(const char *str, int *min, int *max)
+{
+	int level;
+
+	if (strcmp(str, "*") == 0) {
+		*min = 0;
+		*max = SYSLOG_NUM_LEVELS - 1;
+		return 0;
+	}
+
+	level = level_id_from_string(str[0] == '=' ? str + 1 : str);
+	if (level < 0)
+		return -1;
+
+	/* a level matches it and everything more severe */
+	*min = str[0] == '=' ? level : 0;
+	*max = level;
+	return 0;
+}
+
+/* "<facility>[,<facility>...].<level>" */
+static int parse_selector(char *str, uint64_t *mask)
+{
+	int fac, lvl, min, max;
+	char *level, *next;
+
+	level = strrchr(str, '.');
+	if (level == NULL)
+		return -1;
+	*(level++) = '\0';
+
+	if (parse_level(level, &min, &max))
+		return -1;
+
+	for (; str != NULL; str = next) {
+		next = strchr(str, ',');
+		if (next != NULL)
+			*(next++) = '\0';
+
+		if (strcmp(str, "*") == 0) {
+			fac = -1;
+		} else {
+			fac = facility_id_from_string(str);
+			if (fac < 0)
+				return -1;
+		}
+
+		for (lvl = min; lvl <= max; ++lvl) {
+			if (fac >= 0) {
+				mask_set(mask, fac, lvl);
+				continue;
+			}
+
+			for (fac = 0; fac < SYSLOG_NUM_FACILITIES; ++fac)
+				mask_set(mask, fac, lvl);
+			fac = -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+  No dots, so the file of a stream can never look like a rotated one
+  (<stream>.log.<suffix>) to the archive thread and the retention.
+ */
+static bool is_stream_name(const char *str)
+{
+	if (*str == '\0')
+		return false;
+
+	for (; *str != '\0'; ++str) {
+		if (!isalnum(*str) && *str != '_' && *str != '-')
+			return false;
+	}
+
+	return true;
+}
+
+/*
+  Parse a rule of the form
+    <selector> [ident=<glob>] drop
+    <selector> [ident=<glob>] file [<stream>]
+    <selector> [ident=<glob>] backend <name> [<stream>]
+ */
+static const char *parse_rule(log_backend_rules_t *log, rule_t *rule,
+			      char *line)
+{
+	char *tok[6], *save = NULL, *stream = NULL;
+	int i, count = 0, argc;
+
+	for (tok[count] = strtok_r(line, " \t", &save);
+	     tok[count] != NULL && tok[count][0] != '#';
+	     tok[count] = strtok_r(NULL, " \t", &save)) {
+		if (++count == 6)
+			return "too many arguments";
+	}
+
+	if (count < 2)
+		return "expected a selector and an action";
+
+	if (parse_selector(tok[0], rule->mask))
+		return "invalid selector, expected <facility>.<level>";
+
+	i = 1;
+	if (strncmp(tok[i], "ident=", 6) == 0) {
+		rule->ident = strdup(tok[i] + 6);
+		if (rule->ident == NULL)
+			return strerror(errno);
+		++i;
+	}
+
+	if (i >= count)
+		return "missing action";
+
+	argc = count - i - 1;
+
+	if (strcmp(tok[i], "drop") == 0) {
+		if (argc != 0)
+			return "drop takes no arguments";
+		return NULL;
+	} else if (strcmp(tok[i], "file") == 0) {
+		if (argc > 1)
+			return "file takes at most one argument";
+		rule->backend = log->fallback;
+		stream = argc > 0 ? tok[i + 1] : NULL;
+	} else if (strcmp(tok[i], "backend") == 0) {
+		if (argc < 1 || argc > 2)
+			return "expected a backend name and optional stream";
+		rule->backend = log_backend_by_name(tok[i + 1]);
+		if (rule->backend == NULL)
+			return "unknown backend";
+		stream = argc > 1 ? tok[i + 2] : NULL;
+	} else {
+		return "unknown action";
+	}
+
+	if (stream != NULL) {
+		if (!is_stream_name(stream))
+			return "invalid stream name";
+
+		rule->stream = strdup(stream);
+		if (rule->stream == NULL)
+			return strerror(errno);
+		rule->stream_hash = ident_hash(stream);
+	}
+
+	return NULL;
+}
+
+static void ruleset_compile(ruleset_t *rs)
+{
+	unsigned int i;
+	int fac, lvl;
+
+	for (fac = 0; fac < SYSLOG_NUM_FACILITIES; ++fac) {
+		for (lvl = 0; lvl < SYSLOG_NUM_LEVELS; ++lvl)
+			rs->table[fac][lvl] = rs->count;
+	}
+
+	for (i = rs->count; i-- > 0; ) {
+		if (rs->rules[i].ident != NULL) {
+			rs->has_ident_rules = true;
+			continue;
+		}
+
+		for (fac = 0; fac < SYSLOG_NUM_FACILITIES; ++fac) {
+			for (lvl = 0; lvl < SYSLOG_NUM_LEVELS; ++lvl) {
+				if (mask_test(rs->rules[i].mask, fac, lvl))
+					rs->table[fac][lvl] = i;
+			}
+		}
+	}
+}
+
+static ruleset_t *ruleset_load(log_backend_rules_t *log)
+{
+	const char *err = NULL;
+	size_t n = 0, lineno = 0;
+	char *line = NULL, *ptr;
+	ruleset_t *rs = NULL;
+	rule_t *new;
+	ssize_t ret;
+	FILE *fp;
+	int fd;
+
+	fd = open(log->filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || (fp = fdopen(fd, "r")) == NULL) {
+		fprintf(stderr, "%s: %s\n", log->filename, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+
+	rs = calloc(1, sizeof(*rs));
+	if (rs == NULL) {
+		err = strerror(errno);
+		goto fail;
+	}
+
+	while ((ret = getline(&line, &n, fp)) >= 0) {
+		++lineno;
+
+		if (ret > 0 && line[ret - 1] == '\n')
+			line[ret - 1] = '\0';
+
+		for (ptr = line; isspace(*ptr); ++ptr)
+			;
+
+		if (*ptr == '\0' || *ptr == '#')
+			continue;
+
+		new = realloc(rs->rules, (rs->count + 1) * sizeof(rs->rules[0]));
+		if (new == NULL) {
+			err = strerror(errno);
+			goto fail;
+		}
+
+		rs->rules = new;
+		memset(rs->rules + rs->count, 0, sizeof(rs->rules[0]));
+		rs->count += 1;
+
+		err = parse_rule(log, rs->rules + rs->count - 1, ptr);
+		if (err != NULL)
+			goto fail;
+	}
+
+	if (rs->count >= UINT_MAX) {
+		err = "too many rules";
+		goto fail;
+	}
+
+	rs->cache = calloc(IDENT_CACHE_SIZE, sizeof(rs->cache[0]));
+	if (rs->cache == NULL) {
+		err = strerror(errno);
+		goto fail;
+	}
+
+	ruleset_compile(rs);
+	free(line);
+	fclose(fp);
+	return rs;
+fail:
+	fprintf(stderr, "%s: %zu: %s\n", log->filename, lineno, err);
+	ruleset_free(rs);
+	free(line);
+	fclose(fp);
+	return NULL;
+}
+
+/*****************************************************************************/
+
+/*
+  Get the cached list of rules with an ident pattern that match an
+  ident. Returns NULL if the ident is not in the cache and the cache is
+  full.
+ */
+static ident_entry_t *ident_lookup(ruleset_t *rs, const char *ident,
+				   uint32_t hash)
+{
+	size_t i, mask = IDENT_CACHE_SIZE - 1;
+	ident_entry_t *e;
+	unsigned int j;
+
+	for (i = hash & mask; (e = rs->cache[i]) != NULL; i = (i + 1) & mask) {
+		if (e->hash == hash && strcmp(e->name, ident) == 0)
+			return e;
+	}
+
+	/* keep the load factor at or below 1/2 */
+	if ((rs->cache_count + 1) * 2 > IDENT_CACHE_SIZE)
+		return NULL;
+
+	e = calloc(1, sizeof(*e) + strlen(ident) + 1);
+	if (e == NULL)
+		return NULL;
+
+	e->hash = hash;
+	strcpy(e->name, ident);
+
+	for (j = 0; j < rs->count; ++j) {
+		if (rs->rules[j].ident == NULL ||
+		    fnmatch(rs->rules[j].ident, ident, 0) != 0)
+			continue;
+
+		if (e->count < IDENT_CACHE_RULES)
+			e->rules[e->count] = j;
+		e->count += 1;
+	}
+
+	rs->cache[i] = e;
+	rs->cache_count += 1;
+	return e;
+}
+
+static const rule_t *ruleset_match(ruleset_t *rs, const syslog_msg_t *msg)
+{
+	unsigned int i, best = rs->table[msg->facility][msg->level];
+	ident_entry_t *e;
+
+	if (msg->ident == NULL || !rs->has_ident_rules)
+		goto out;
+
+	e = ident_lookup(rs, msg->ident, msg->ident_hash);
+
+	if (e != NULL && e->count <= IDENT_CACHE_RULES) {
+		for (i = 0; i < e->count && e->rules[i] < best; ++i) {
+			if (mask_test(rs->rules[e->rules[i]].mask,
+				      msg->facility, msg->level)) {
+				best = e->rules[i];
+				break;
+			}
+		}
+		goto out;
+	}
+
+	for (i = 0; i < best; ++i) {
+		if (rs->rules[i].ident != NULL &&
+		    mask_test(rs->rules[i].mask, msg->facility, msg->level) &&
+		    fnmatch(rs->rules[i].ident, msg->ident, 0) == 0) {
+			best = i;
+			break;
+		}
+	}
+out:
+	return best < rs->count ? rs->rules + best : NULL;
+}
+
+/*****************************************************************************/
+
+/* Initialize all backends referenced by a rule set that are not yet. */
+static int rules_init_backends(log_backend_rules_t *log, ruleset_t *rs)
+{
+	log_backend_t *backend;
+	size_t i, j;
+
+	for (i = 0; i < rs->count; ++i) {
+		backend = rs->rules[i].backend;
+		if (backend == NULL)
+			continue;
+
+		for (j = 0; j < log->num_backends; ++j) {
+			if (log->backends[j] == backend)
+				break;
+		}
+
+		if (j < log->num_backends)
+			continue;
+
+		if (log->num_backends == MAX_BACKENDS) {
+			fputs("too many different backends in use\n", stderr);
+			return -1;
+		}
+
+		if (backend->init(backend, log->cfg))
+			return -1;
+
+		log->backends[log->num_backends++] = backend;
+	}
+
+	return 0;
+}
+
+static int rules_backend_init(log_backend_t *backend, const log_config_t *cfg)
+{
+	log_backend_rules_t *log = (log_backend_rules_t *)backend;
+
+	log->cfg = cfg;
+	return rules_init_backends(log, log->rules);
+}
+
+static void rules_backend_cleanup(log_backend_t *backend)
+{
+	log_backend_rules_t *log = (log_backend_rules_t *)backend;
+	size_t i;
+
+	for (i = 0; i < log->num_backends; ++i)
+		log->backends[i]->cleanup(log->backends[i]);
+
+	log->num_backends = 0;
+	ruleset_free(log->rules);
+	log->rules = NULL;
+	free(log->filename);
+	free(log);
+}
+
+static int rules_backend_write(log_backend_t *backend, const syslog_msg_t *msg)
+{
+	log_backend_rules_t *log = (log_backend_rules_t *)backend;
+	const rule_t *rule;
+	syslog_msg_t copy;
+
+	if (msg->facility < 0 || msg->facility >= SYSLOG_NUM_FACILITIES ||
+	    msg->level < 0 || msg->level >= SYSLOG_NUM_LEVELS) {
+		return -1;
+	}
+
+	rule = ruleset_match(log->rules, msg);
+	if (rule == NULL || rule->backend == NULL)
+		return 0;
+
+	if (rule->stream == NULL)
+		return rule->backend->write(rule->backend, msg);
+
+	copy = *msg;
+	copy.stream = rule->stream;
+	copy.stream_hash = rule->stream_hash;
+	return rule->backend->write(rule->backend, &copy);
+}
+
+static void rules_backend_rotate(log_backend_t *backend)
+{
+	log_backend_rules_t *log = (log_backend_rules_t *)backend;
+	size_t i;
+
+	for (i = 0; i < log->num_backends; ++i)
+		log->backends[i]->rotate(log->backends[i]);
+}
+
+static int rules_backend_tick(log_backend_t *backend)
+{
+	log_backend_rules_t *log = (log_backend_rules_t *)backend;
+	int ret, timeout = -1;
+	size_t i;
+
+	for (i = 0; i < log->num_backends; ++i) {
+		ret = log->backends[i]->tick(log->backends[i]);
+
+		if (ret >= 0 && (timeout < 0 || ret < timeout))
+			timeout = ret;
+	}
+
+	return timeout;
+}
+
+static void rules_backend_stream_stats(log_backend_t *backend,
+				       log_stream_fn fn, void *user)
+{
+	log_backend_rules_t *log = (log_backend_rules_t *)backend;
+	size_t i;
+
+	for (i = 0; i < log->num_backends; ++i) {
+		if (log->backends[i]->stream_stats != NULL) {
+			log->backends[i]->stream_stats(log->backends[i],
+						       fn, user);
+		}
+	}
+}
+
+static int rules_backend_reload(log_backend_t *backend)
+{
+	log_backend_rules_t *log = (log_backend_rules_t *)backend;
+	ruleset_t *rs;
+
+	rs = ruleset_load(log);
+	if (rs == NULL)
+		return -1;
+
+	if (rules_init_backends(log, rs)) {
+		ruleset_free(rs);
+		return -1;
+	}
+
+	ruleset_free(log->rules);
+	log->rules = rs;
+	return 0;
+}
+
+log_backend_t *rules_backend_create(const char *path, log_backend_t *fallback)
+{
+	log_backend_rules_t *log;
+
+	log = calloc(1, sizeof(*log));
+	if (log == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+
+	log->base.init = rules_backend_init;
+	log->base.cleanup = rules_backend_cleanup;
+	log->base.write = rules_backend_write;
+	log->base.rotate = rules_backend_rotate;
+	log->base.tick = rules_backend_tick;
+	log->base.stream_stats = rules_backend_stream_stats;
+	log->base.reload = rules_backend_reload;
+	log->fallback = fallback;
+
+	/*
+	  The daemon changes into the log directory, so a relative path
+	  would no longer work on reload.
+	 */
+	log->filename = realpath(path, NULL);
+	if (log->filename == NULL) {
+		perror(path);
+		goto fail;
+	}
+
+	log->rules = ruleset_load(log);
+	if (log->rules == NULL)
+		goto fail;
+
+	return (log_backend_t *)log;
+fail:
+	free(log->filename);
+	free(log);
+	return NULL;
+}
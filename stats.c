@@ -0,0 +1,521 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "syslogd.h"
+
+/* how long a client of the statistics socket may take to send a request */
+#define STATS_REQUEST_TIMEOUT 100
+
+/* how long a client may take to read the response, in milliseconds */
+#define STATS_SEND_TIMEOUT 1000
+
+/* clients served at the same time, further ones are turned away */
+#define STATS_MAX_CLIENTS 4
+
+/* how often clients are checked while some are being served */
+#define STATS_POLL_INTERVAL 10
+
+/*
+  A client of the statistics socket. All I/O is non-blocking, so a slow
+  client cannot hold up the thread that writes the log messages.
+ */
+typedef struct {
+	int fd;
+
+	/* the response, NULL while waiting for the request */
+	char *data;
+	size_t size;
+	size_t off;
+
+	/* monotonic time in milliseconds at which the client is dropped */
+	long long deadline;
+} stats_client_t;
+
+static stats_client_t clients[STATS_MAX_CLIENTS];
+static size_t num_clients = 0;
+
+/* upper bounds of the fsync latency histogram buckets in microseconds */
+static const uint64_t fsync_bounds[STATS_FSYNC_BUCKETS] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000, 1000000,
+};
+
+syslog_stats_t stats;
+
+void stats_message(const syslog_msg_t *msg, size_t len)
+{
+	if (msg->facility < 0 || msg->facility >= SYSLOG_NUM_FACILITIES ||
+	    msg->level < 0 || msg->level >= SYSLOG_NUM_LEVELS) {
+		return;
+	}
+
+	STATS_ADD(stats.messages[msg->facility][msg->level], 1);
+	STATS_ADD(stats.bytes[msg->facility][msg->level], len);
+}
+
+void stats_fsync(uint64_t us)
+{
+	size_t i;
+
+	for (i = 0; i < STATS_FSYNC_BUCKETS; ++i) {
+		if (us <= fsync_bounds[i])
+			break;
+	}
+
+	STATS_ADD(stats.fsync_hist[i], 1);
+	STATS_ADD(stats.fsyncs, 1);
+	STATS_ADD(stats.fsync_us, us);
+
+	if (us > stats.fsync_max_us)
+		__atomic_store_n(&stats.fsync_max_us, us, __ATOMIC_RELAXED);
+}
+
+static uint64_t load(const uint64_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/*****************************************************************************/
+
+static void text_stream(void *user, const char *name, size_t namelen,
+			uint64_t messages, uint64_t bytes)
+{
+	fprintf(user, "stream %.*s messages=%llu bytes=%llu\n",
+		(int)namelen, name, (unsigned long long)messages,
+		(unsigned long long)bytes);
+}
+
+static void dump_text(FILE *out, msgring_t *ring)
+{
+	uint64_t count;
+	int i, j;
+
+	for (i = 0; i < SYSLOG_NUM_FACILITIES; ++i) {
+		for (j = 0; j < SYSLOG_NUM_LEVELS; ++j) {
+			count = load(&stats.messages[i][j]);
+			if (count == 0)
+				continue;
+
+			fprintf(out, "%s.%s messages=%llu bytes=%llu\n",
+				facility_id_to_string(i),
+				level_id_to_string(j),
+				(unsigned long long)count,
+				(unsigned long long)load(&stats.bytes[i][j]));
+		}
+	}
+
+	logmgr->stream_stats(logmgr, text_stream, out);
+
+	fprintf(out, "parse_errors %llu\n",
+		(unsigned long long)load(&stats.parse_errors));
+	fprintf(out, "ratelimited %llu\n",
+		(unsigned long long)load(&stats.ratelimited));
+	fprintf(out, "write_errors %llu\n",
+		(unsigned long long)load(&stats.write_errors));
+	fprintf(out, "rotations %llu\n",
+		(unsigned long long)load(&stats.rotations));
+	fprintf(out, "evictions %llu\n",
+		(unsigned long long)load(&stats.evictions));
+	fprintf(out, "reopens %llu\n",
+		(unsigned long long)load(&stats.reopens));
+	fprintf(out, "kernel_drops %llu\n",
+		(unsigned long long)load(&stats.kernel_drops));
+	fprintf(out, "compressed files=%llu in_bytes=%llu out_bytes=%llu "
+		"errors=%llu\n", (unsigned long long)load(&stats.compressed),
+		(unsigned long long)load(&stats.compress_in_bytes),
+		(unsigned long long)load(&stats.compress_out_bytes),
+		(unsigned long long)load(&stats.compress_errors));
+	fprintf(out, "disk_usage live=%llu rotated=%llu\n",
+		(unsigned long long)load(&stats.live_bytes),
+		(unsigned long long)load(&stats.rotated_bytes));
+	fprintf(out, "expired files=%llu bytes=%llu archive_errors=%llu\n",
+		(unsigned long long)load(&stats.expired),
+		(unsigned long long)load(&stats.expired_bytes),
+		(unsigned long long)load(&stats.archive_errors));
+	fprintf(out, "forward spooled=%llu dropped=%llu errors=%llu "
+		"spool_bytes=%llu\n",
+		(unsigned long long)load(&stats.forward_spooled),
+		(unsigned long long)load(&stats.forward_dropped),
+		(unsigned long long)load(&stats.forward_errors),
+		(unsigned long long)load(&stats.forward_spool_bytes));
+
+	count = load(&stats.fsyncs);
+	fprintf(out, "fsync count=%llu avg_us=%llu max_us=%llu\n",
+		(unsigned long long)count,
+		(unsigned long long)(count ? load(&stats.fsync_us) / count : 0),
+		(unsigned long long)load(&stats.fsync_max_us));
+
+	if (ring != NULL) {
+		fprintf(out, "queue depth=%zu size=%zu high_water=%zu "
+			"drops=%llu\n", msgring_depth(ring), ring->mask + 1,
+			__atomic_load_n(&ring->high_water, __ATOMIC_RELAXED),
+			(unsigned long long)load(&ring->drops));
+	}
+}
+
+static void prom_header(FILE *out, const char *name, const char *type,
+			const char *help)
+{
+	fprintf(out, "# HELP usyslogd_%s %s\n", name, help);
+	fprintf(out, "# TYPE usyslogd_%s %s\n", name, type);
+}
+
+static void prom_value(FILE *out, const char *name, const char *type,
+		       const char *help, uint64_t value)
+{
+	prom_header(out, name, type, help);
+	fprintf(out, "usyslogd_%s %llu\n", name, (unsigned long long)value);
+}
+
+static void prom_stream_messages(void *user, const char *name,
+				 size_t namelen, uint64_t messages,
+				 uint64_t bytes)
+{
+	fprintf(user, "usyslogd_stream_messages_total{stream=\"%.*s\"} %llu\n",
+		(int)namelen, name, (unsigned long long)messages);
+	(void)bytes;
+}
+
+static void prom_stream_bytes(void *user, const char *name, size_t namelen,
+			      uint64_t messages, uint64_t bytes)
+{
+	fprintf(user, "usyslogd_stream_bytes_total{stream=\"%.*s\"} %llu\n",
+		(int)namelen, name, (unsigned long long)bytes);
+	(void)messages;
+}
+
+static void prom_matrix(FILE *out, const char *name,
+			uint64_t counters[][SYSLOG_NUM_LEVELS])
+{
+	uint64_t count;
+	int i, j;
+
+	for (i = 0; i < SYSLOG_NUM_FACILITIES; ++i) {
+		for (j = 0; j < SYSLOG_NUM_LEVELS; ++j) {
+			count = load(&counters[i][j]);
+			if (count == 0)
+				continue;
+
+			fprintf(out, "usyslogd_%s{facility=\"%s\","
+				"level=\"%s\"} %llu\n", name,
+				facility_id_to_string(i),
+				level_id_to_string(j),
+				(unsigned long long)count);
+		}
+	}
+}
+
+static void dump_prometheus(FILE *out, msgring_t *ring)
+{
+	uint64_t count = 0;
+	size_t i;
+
+	prom_header(out, "messages_total", "counter",
+		    "Messages received, by facility and level.");
+	prom_matrix(out, "messages_total", stats.messages);
+
+	prom_header(out, "bytes_total", "counter",
+		    "Bytes received, by facility and level.");
+	prom_matrix(out, "bytes_total", stats.bytes);
+
+	prom_header(out, "stream_messages_total", "counter",
+		    "Messages written, by log stream.");
+	logmgr->stream_stats(logmgr, prom_stream_messages, out);
+
+	prom_header(out, "stream_bytes_total", "counter",
+		    "Bytes written, by log stream.");
+	logmgr->stream_stats(logmgr, prom_stream_bytes, out);
+
+	prom_value(out, "parse_errors_total", "counter",
+		   "Messages that could not be parsed.",
+		   load(&stats.parse_errors));
+	prom_value(out, "ratelimited_total", "counter",
+		   "Messages discarded by the per sender rate limit.",
+		   load(&stats.ratelimited));
+	prom_value(out, "write_errors_total", "counter",
+		   "Failed log file opens, writes, syncs and closes.",
+		   load(&stats.write_errors));
+	prom_value(out, "rotations_total", "counter",
+		   "Log files rotated.", load(&stats.rotations));
+	prom_value(out, "evictions_total", "counter",
+		   "Log files closed to stay below the open file limit.",
+		   load(&stats.evictions));
+	prom_value(out, "reopens_total", "counter",
+		   "Evicted log files opened again.", load(&stats.reopens));
+	prom_value(out, "kernel_drops_total", "counter",
+		   "Datagrams dropped by the kernel on the socket.",
+		   load(&stats.kernel_drops));
+	prom_value(out, "compressed_files_total", "counter",
+		   "Rotated log files compressed.", load(&stats.compressed));
+	prom_value(out, "compress_in_bytes_total", "counter",
+		   "Size of the compressed log files before compression.",
+		   load(&stats.compress_in_bytes));
+	prom_value(out, "compress_out_bytes_total", "counter",
+		   "Size of the compressed log files after compression.",
+		   load(&stats.compress_out_bytes));
+	prom_value(out, "compress_errors_total", "counter",
+		   "Rotated log files that could not be compressed.",
+		   load(&stats.compress_errors));
+	prom_value(out, "live_bytes", "gauge",
+		   "Current size of the log files being written.",
+		   load(&stats.live_bytes));
+	prom_value(out, "rotated_bytes", "gauge",
+		   "Current size of the rotated log files that are tracked.",
+		   load(&stats.rotated_bytes));
+	prom_value(out, "expired_files_total", "counter",
+		   "Rotated log files removed by the retention policy.",
+		   load(&stats.expired));
+	prom_value(out, "expired_bytes_total", "counter",
+		   "Size of the rotated log files removed.",
+		   load(&stats.expired_bytes));
+	prom_value(out, "archive_errors_total", "counter",
+		   "Rotated log files that could not be synced or closed.",
+		   load(&stats.archive_errors));
+	prom_value(out, "forward_spooled_total", "counter",
+		   "Messages written to the spool file of the forwarding "
+		   "backend.", load(&stats.forward_spooled));
+	prom_value(out, "forward_dropped_total", "counter",
+		   "Messages that could neither be forwarded nor spooled.",
+		   load(&stats.forward_dropped));
+	prom_value(out, "forward_errors_total", "counter",
+		   "Failed connections to the remote collector.",
+		   load(&stats.forward_errors));
+	prom_value(out, "forward_spool_bytes", "gauge",
+		   "Size of the messages in the spool that were not sent yet.",
+		   load(&stats.forward_spool_bytes));
+
+	prom_header(out, "fsync_seconds", "histogram",
+		    "Time taken by fsync and fdatasync.");
+
+	for (i = 0; i < STATS_FSYNC_BUCKETS; ++i) {
+		count += load(&stats.fsync_hist[i]);
+		fprintf(out, "usyslogd_fsync_seconds_bucket{le=\"%g\"} %llu\n",
+			(double)fsync_bounds[i] / 1e6,
+			(unsigned long long)count);
+	}
+
+	count += load(&stats.fsync_hist[i]);
+	fprintf(out, "usyslogd_fsync_seconds_bucket{le=\"+Inf\"} %llu\n",
+		(unsigned long long)count);
+	fprintf(out, "usyslogd_fsync_seconds_sum %g\n",
+		(double)load(&stats.fsync_us) / 1e6);
+	fprintf(out, "usyslogd_fsync_seconds_count %llu\n",
+		(unsigned long long)count);
+
+	if (ring == NULL)
+		return;
+
+	prom_value(out, "queue_depth", "gauge",
+		   "Messages waiting in the queue.", msgring_depth(ring));
+	prom_value(out, "queue_size", "gauge",
+		   "Capacity of the queue.", ring->mask + 1);
+	prom_value(out, "queue_high_water", "gauge",
+		   "Maximum number of messages in the queue so far.",
+		   __atomic_load_n(&ring->high_water, __ATOMIC_RELAXED));
+	prom_value(out, "queue_drops_total", "counter",
+		   "Messages dropped because the queue was full.",
+		   load(&ring->drops));
+}
+
+void stats_dump(FILE *out, int format, msgring_t *ring)
+{
+	if (format == STATS_FORMAT_PROMETHEUS) {
+		dump_prometheus(out, ring);
+	} else {
+		dump_text(out, ring);
+	}
+}
+
+/*****************************************************************************/
+
+int stats_socket(const char *path)
+{
+	struct sockaddr_un un;
+	const char *errmsg;
+	int fd;
+
+	if (strlen(path) >= sizeof(un.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&un, 0, sizeof(un));
+	un.sun_family = AF_UNIX;
+	strcpy(un.sun_path, path);
+
+	unlink(un.sun_path);
+
+	if (bind(fd, (struct sockaddr *)&un, sizeof(un))) {
+		errmsg = "bind";
+		goto fail_errno;
+	}
+
+	if (chmod(path, 0660)) {
+		errmsg = "chmod";
+		goto fail_errno;
+	}
+
+	if (listen(fd, 4)) {
+		errmsg = "listen";
+		goto fail_errno;
+	}
+
+	return fd;
+fail_errno:
+	fprintf(stderr, "%s: %s: %s\n", path, errmsg, strerror(errno));
+	close(fd);
+	unlink(path);
+	return -1;
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000L;
+}
+
+static void client_drop(size_t i)
+{
+	close(clients[i].fd);
+	free(clients[i].data);
+	clients[i] = clients[--num_clients];
+}
+
+/*
+  Get the requested format. Returns -1 if the request has not arrived
+  yet and the client still has time to send it.
+ */
+static int read_request(stats_client_t *c, long long now)
+{
+	char buffer[32];
+	ssize_t ret;
+
+	ret = recv(c->fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR) &&
+	    now < c->deadline) {
+		return -1;
+	}
+
+	if (ret <= 0)
+		return STATS_FORMAT_TEXT;
+
+	buffer[ret] = '\0';
+	buffer[strcspn(buffer, "\r\n")] = '\0';
+
+	if (strcmp(buffer, "prometheus") == 0)
+		return STATS_FORMAT_PROMETHEUS;
+
+	return STATS_FORMAT_TEXT;
+}
+
+/* Make progress on a client. Returns false once it is done. */
+static bool client_serve(stats_client_t *c, msgring_t *ring, long long now)
+{
+	ssize_t ret;
+	int format;
+	FILE *out;
+
+	if (c->data == NULL) {
+		format = read_request(c, now);
+		if (format < 0)
+			return true;
+
+		out = open_memstream(&c->data, &c->size);
+		if (out == NULL) {
+			perror("open_memstream");
+			return false;
+		}
+
+		stats_dump(out, format, ring);
+
+		if (fclose(out) != 0) {
+			perror("formatting statistics");
+			return false;
+		}
+
+		c->deadline = now + STATS_SEND_TIMEOUT;
+	}
+
+	while (c->off < c->size) {
+		ret = send(c->fd, c->data + c->off, c->size - c->off,
+			   MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN && now < c->deadline;
+		}
+
+		c->off += ret;
+	}
+
+	return false;
+}
+
+void stats_serve(int fd, msgring_t *ring)
+{
+	int cfd;
+
+	for (;;) {
+		cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+		if (cfd < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				perror("accept");
+			break;
+		}
+
+		if (num_clients == STATS_MAX_CLIENTS) {
+			close(cfd);
+			continue;
+		}
+
+		memset(&clients[num_clients], 0, sizeof(clients[0]));
+		clients[num_clients].fd = cfd;
+		clients[num_clients].deadline = now_ms() + STATS_REQUEST_TIMEOUT;
+		num_clients += 1;
+	}
+
+	stats_tick(ring);
+}
+
+int stats_tick(msgring_t *ring)
+{
+	long long now;
+	size_t i;
+
+	if (num_clients == 0)
+		return -1;
+
+	now = now_ms();
+
+	for (i = 0; i < num_clients; ) {
+		if (client_serve(&clients[i], ring, now)) {
+			++i;
+		} else {
+			client_drop(i);
+		}
+	}
+
+	return num_clients > 0 ? STATS_POLL_INTERVAL : -1;
+}
+
+void stats_cleanup(void)
+{
+	while (num_clients > 0)
+		client_drop(0);
+}
@@ -0,0 +1,934 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "syslogd.h"
+
+/* segment size if no size limit is configured */
+#define STORE_SEGMENT_MAX (64 * 1024 * 1024)
+
+#define STORE_NAME_MAX 32
+
+typedef struct {
+	uint32_t hash;
+	uint32_t id;
+	size_t length;
+	char name[];
+} store_ident_t;
+
+typedef struct {
+	log_backend_t base;
+
+	/* number of the segment being written, 0 if none is open */
+	unsigned int segment;
+	unsigned int last_segment;
+	int data_fd;
+	int idx_fd;
+
+	/* bytes in the data file, not counting the unwritten block part */
+	uint64_t size;
+
+	/* the current block, written to the file up to "written" */
+	char *block;
+	size_t used;
+	size_t written;
+	store_idx_block_t cur;
+
+	/* index entries waiting for the current block to complete */
+	char *pending;
+	size_t pending_used;
+	size_t pending_max;
+
+	/* all completed blocks of the segment, for sealing */
+	store_idx_block_t *blocks;
+	size_t block_count;
+	size_t block_max;
+
+	/* idents of the segment, indexed by ID - 1 */
+	store_ident_t **idents;
+	size_t ident_count;
+	size_t ident_max;
+
+	/* open addressing hash table of the idents */
+	store_ident_t **table;
+	size_t table_size;
+
+	int64_t min_time;
+	int64_t max_time;
+
+	/* set if writing failed and the segment must be sealed as it is */
+	bool failed;
+
+	size_t maxsize;
+	int sync_mode;
+	bool unbuffered;
+	unsigned int flush_interval;
+	long long flush_due;
+
+	uint64_t messages;
+	uint64_t bytes;
+} log_backend_store_t;
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000L;
+}
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000L;
+}
+
+static void segment_name(char *out, unsigned int segment, const char *ext)
+{
+	snprintf(out, STORE_NAME_MAX, "store.%08u.%s", segment, ext);
+}
+
+static int write_full(int fd, const void *data, size_t size)
+{
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = write(fd, data, size);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		data = (const char *)data + ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static int grow(void **array, size_t *max, size_t count, size_t size)
+{
+	size_t new_max = *max ? *max * 2 : 64;
+	void *new;
+
+	if (count < *max)
+		return 0;
+
+	new = realloc(*array, new_max * size);
+	if (new == NULL) {
+		perror("realloc");
+		return -1;
+	}
+
+	*array = new;
+	*max = new_max;
+	return 0;
+}
+
+static void time_range(int64_t *min, int64_t *max, int64_t t)
+{
+	if (t < *min)
+		*min = t;
+	if (t > *max)
+		*max = t;
+}
+
+/*****************************************************************************/
+
+static void idents_reset(log_backend_store_t *log)
+{
+	size_t i;
+
+	for (i = 0; i < log->ident_count; ++i)
+		free(log->idents[i]);
+
+	if (log->table != NULL)
+		memset(log->table, 0, log->table_size * sizeof(log->table[0]));
+
+	log->ident_count = 0;
+}
+
+static uint32_t ident_find(log_backend_store_t *log, const char *name,
+			   uint32_t hash)
+{
+	size_t i, mask = log->table_size - 1;
+	store_ident_t *id;
+
+	if (log->table == NULL)
+		return 0;
+
+	for (i = hash & mask; (id = log->table[i]) != NULL;
+	     i = (i + 1) & mask) {
+		if (id->hash == hash && strcmp(id->name, name) == 0)
+			return id->id;
+	}
+
+	return 0;
+}
+
+static void table_insert(log_backend_store_t *log, store_ident_t *id)
+{
+	size_t i, mask = log->table_size - 1;
+
+	for (i = id->hash & mask; log->table[i] != NULL; i = (i + 1) & mask)
+		;
+
+	log->table[i] = id;
+}
+
+/* Add an ident, keeping the table at most half full. Returns the ID. */
+static uint32_t ident_add(log_backend_store_t *log, const char *name,
+			  size_t length, uint32_t hash)
+{
+	size_t i, new_size;
+	store_ident_t *id;
+
+	if ((log->ident_count + 1) * 2 > log->table_size) {
+		new_size = log->table_size ? log->table_size * 2 : 256;
+
+		free(log->table);
+		log->table = calloc(new_size, sizeof(log->table[0]));
+		if (log->table == NULL) {
+			perror("calloc");
+			log->table_size = 0;
+			idents_reset(log);
+			return 0;
+		}
+
+		log->table_size = new_size;
+		for (i = 0; i < log->ident_count; ++i)
+			table_insert(log, log->idents[i]);
+	}
+
+	if (grow((void **)&log->idents, &log->ident_max, log->ident_count,
+		 sizeof(log->idents[0]))) {
+		return 0;
+	}
+
+	id = calloc(1, sizeof(*id) + length + 1);
+	if (id == NULL) {
+		perror("calloc");
+		return 0;
+	}
+
+	memcpy(id->name, name, length);
+	id->length = length;
+	id->hash = hash;
+	id->id = log->ident_count + 1;
+
+	log->idents[log->ident_count++] = id;
+	table_insert(log, id);
+	return id->id;
+}
+
+/*****************************************************************************/
+
+static int pending_add(log_backend_store_t *log, const void *entry,
+		       size_t size, const void *extra, size_t extra_size)
+{
+	size_t total = STORE_ALIGN(size + extra_size);
+	char *new;
+
+	if (log->pending_used + total > log->pending_max) {
+		new = realloc(log->pending, (log->pending_used + total) * 2);
+		if (new == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		log->pending = new;
+		log->pending_max = (log->pending_used + total) * 2;
+	}
+
+	memset(log->pending + log->pending_used, 0, total);
+	memcpy(log->pending + log->pending_used, entry, size);
+	memcpy(log->pending + log->pending_used + size, extra, extra_size);
+	log->pending_used += total;
+	return 0;
+}
+
+static void block_reset(log_backend_store_t *log)
+{
+	memset(&log->cur, 0, sizeof(log->cur));
+	log->cur.hdr.type = STORE_IDX_BLOCK;
+	log->cur.hdr.size = sizeof(log->cur);
+	log->cur.offset = log->size;
+	log->cur.min_time = INT64_MAX;
+	log->cur.max_time = INT64_MIN;
+	log->used = 0;
+	log->written = 0;
+}
+
+/* Write out the unwritten part of the current block. */
+static int block_flush(log_backend_store_t *log)
+{
+	size_t count = log->used - log->written;
+	long long start;
+	int ret;
+
+	if (count == 0)
+		return 0;
+
+	if (write_full(log->data_fd, log->block + log->written, count))
+		goto fail;
+
+	log->written = log->used;
+	log->size += count;
+
+	if (log->sync_mode == LOG_SYNC_NONE)
+		return 0;
+
+	start = now_us();
+
+	if (log->sync_mode == LOG_SYNC_DATA) {
+		ret = fdatasync(log->data_fd);
+	} else {
+		ret = fsync(log->data_fd);
+	}
+
+	stats_fsync(now_us() - start);
+
+	if (ret != 0)
+		goto fail;
+
+	return 0;
+fail:
+	perror("writing log store segment");
+	STATS_ADD(stats.write_errors, 1);
+
+	/* don't leave a torn record behind */
+	if (ftruncate(log->data_fd, log->size))
+		perror("truncating log store segment");
+
+	log->used = log->written;
+	log->failed = true;
+	return -1;
+}
+
+/*
+  Complete the current block, i.e. write it out and add it to the index,
+  along with the ident definitions it contains.
+ */
+static int block_close(log_backend_store_t *log)
+{
+	if (log->used == 0)
+		return 0;
+
+	if (block_flush(log))
+		return -1;
+
+	log->cur.length = log->used;
+
+	if (grow((void **)&log->blocks, &log->block_max, log->block_count,
+		 sizeof(log->blocks[0]))) {
+		return -1;
+	}
+
+	log->blocks[log->block_count++] = log->cur;
+
+	if (log->cur.count > 0) {
+		time_range(&log->min_time, &log->max_time, log->cur.min_time);
+		time_range(&log->min_time, &log->max_time, log->cur.max_time);
+	}
+
+	if (pending_add(log, &log->cur, sizeof(log->cur), NULL, 0) == 0 &&
+	    write_full(log->idx_fd, log->pending, log->pending_used) != 0) {
+		perror("writing log store index");
+		STATS_ADD(stats.write_errors, 1);
+	}
+
+	log->pending_used = 0;
+	block_reset(log);
+	return 0;
+}
+
+static int record_append(log_backend_store_t *log, const store_record_t *rec,
+			 const char *data)
+{
+	size_t size = STORE_ALIGN(sizeof(*rec) + rec->length);
+	store_record_t *out;
+
+	if (log->used + size > STORE_BLOCK_SIZE && block_close(log))
+		return -1;
+
+	out = (store_record_t *)(log->block + log->used);
+	*out = *rec;
+	out->size = size;
+
+	memcpy(out + 1, data, rec->length);
+	memset((char *)(out + 1) + rec->length, 0,
+	       size - sizeof(*rec) - rec->length);
+
+	if (log->used == log->written)
+		log->flush_due = now_ms() + log->flush_interval;
+
+	log->used += size;
+
+	if (rec->facility == STORE_IDENT_RECORD)
+		return 0;
+
+	log->cur.count += 1;
+	log->cur.ident_mask |= 1ULL << (rec->ident % 64);
+	time_range(&log->cur.min_time, &log->cur.max_time, rec->timestamp);
+	return 0;
+}
+
+/*****************************************************************************/
+
+static int write_header(int fd, const char *magic, uint32_t flags)
+{
+	store_header_t hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, magic, sizeof(hdr.magic));
+	hdr.version = STORE_VERSION;
+	hdr.flags = flags;
+
+	return write_full(fd, &hdr, sizeof(hdr));
+}
+
+static int segment_open(log_backend_store_t *log)
+{
+	char name[STORE_NAME_MAX];
+	unsigned int segment = log->last_segment + 1;
+
+	/* don't try the same name again if this fails */
+	log->last_segment = segment;
+
+	segment_name(name, segment, "seg");
+	log->data_fd = open(name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+			    0640);
+	if (log->data_fd < 0)
+		goto fail;
+
+	if (write_header(log->data_fd, STORE_SEG_MAGIC, 0))
+		goto fail_data;
+
+	segment_name(name, segment, "idx");
+	log->idx_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			   0640);
+	if (log->idx_fd < 0)
+		goto fail_data;
+
+	if (write_header(log->idx_fd, STORE_IDX_MAGIC, 0)) {
+		perror(name);
+		close(log->idx_fd);
+		log->idx_fd = -1;
+		goto fail_close;
+	}
+
+	log->segment = segment;
+	log->size = sizeof(store_header_t);
+	log->block_count = 0;
+	log->pending_used = 0;
+	log->min_time = INT64_MAX;
+	log->max_time = INT64_MIN;
+	idents_reset(log);
+	block_reset(log);
+	return 0;
+fail_data:
+	perror(name);
+fail_close:
+	close(log->data_fd);
+	log->data_fd = -1;
+	STATS_ADD(stats.write_errors, 1);
+	return -1;
+fail:
+	perror(name);
+	STATS_ADD(stats.write_errors, 1);
+	return -1;
+}
+
+/*
+  Write the final index of a segment from the in memory tables, through
+  a temporary file that replaces the incremental index once complete.
+ */
+static int index_write_sealed(log_backend_store_t *log, unsigned int segment)
+{
+	char name[STORE_NAME_MAX], tmp[STORE_NAME_MAX + 4];
+	store_idx_ident_t entry;
+	store_header_t hdr;
+	store_ident_t *id;
+	int fd, ret = 0;
+	size_t i;
+
+	segment_name(name, segment, "idx");
+	snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if (fd < 0) {
+		perror(tmp);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, STORE_IDX_MAGIC, sizeof(hdr.magic));
+	hdr.version = STORE_VERSION;
+	hdr.flags = STORE_SEALED;
+	hdr.idents = log->ident_count;
+	hdr.blocks = log->block_count;
+	hdr.min_time = log->min_time;
+	hdr.max_time = log->max_time;
+
+	log->pending_used = 0;
+
+	for (i = 0; i < log->ident_count && ret == 0; ++i) {
+		id = log->idents[i];
+
+		entry.hdr.type = STORE_IDX_IDENT;
+		entry.hdr.size = STORE_ALIGN(sizeof(entry) + id->length);
+		entry.id = id->id;
+		entry.length = id->length;
+
+		ret = pending_add(log, &entry, sizeof(entry), id->name,
+				  id->length);
+	}
+
+	if (ret != 0 ||
+	    write_full(fd, &hdr, sizeof(hdr)) ||
+	    write_full(fd, log->pending, log->pending_used) ||
+	    write_full(fd, log->blocks,
+		       log->block_count * sizeof(log->blocks[0])) ||
+	    fsync(fd)) {
+		perror(tmp);
+		goto fail;
+	}
+
+	if (close(fd)) {
+		fd = -1;
+		perror(tmp);
+		goto fail;
+	}
+
+	log->pending_used = 0;
+
+	if (rename(tmp, name)) {
+		perror(name);
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+fail:
+	log->pending_used = 0;
+	if (fd >= 0)
+		close(fd);
+	unlink(tmp);
+	return -1;
+}
+
+/* Complete the current segment and make its index immutable. */
+static void segment_seal(log_backend_store_t *log)
+{
+	int dfd;
+
+	if (log->segment == 0)
+		return;
+
+	log->failed = false;
+	block_close(log);
+
+	if (fsync(log->data_fd)) {
+		perror("syncing log store segment");
+		STATS_ADD(stats.write_errors, 1);
+	}
+
+	if (index_write_sealed(log, log->segment))
+		STATS_ADD(stats.write_errors, 1);
+
+	close(log->data_fd);
+	close(log->idx_fd);
+	log->data_fd = -1;
+	log->idx_fd = -1;
+	log->segment = 0;
+
+	dfd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd >= 0) {
+		fsync(dfd);
+		close(dfd);
+	}
+
+	STATS_ADD(stats.rotations, 1);
+}
+
+/*****************************************************************************/
+
+static bool record_valid(const store_record_t *rec, uint64_t remaining)
+{
+	if (rec->size < sizeof(*rec) || rec->size % 8 != 0 ||
+	    rec->size > remaining || rec->size > STORE_BLOCK_SIZE) {
+		return false;
+	}
+
+	if (rec->length > rec->size - sizeof(*rec))
+		return false;
+
+	if (rec->facility == STORE_IDENT_RECORD)
+		return true;
+
+	return rec->facility < SYSLOG_NUM_FACILITIES &&
+		rec->level < SYSLOG_NUM_LEVELS;
+}
+
+/*
+  Rebuild the index of a segment that was not sealed, e.g. because of a
+  crash, by scanning the data file. Anything after the last intact record
+  is cut off. The blocks are reconstructed the same way they are built
+  while writing.
+ */
+static int segment_rebuild(log_backend_store_t *log, unsigned int segment)
+{
+	char name[STORE_NAME_MAX];
+	uint64_t offset, end;
+	store_header_t hdr;
+	store_record_t rec;
+	char *data = NULL;
+	struct stat sb;
+	int fd, ret = -1;
+
+	segment_name(name, segment, "seg");
+
+	fd = open(name, O_RDWR | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &sb)) {
+		perror(name);
+		goto out;
+	}
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, STORE_SEG_MAGIC, sizeof(hdr.magic)) != 0) {
+		fprintf(stderr, "%s: not a log store segment\n", name);
+		goto out;
+	}
+
+	data = malloc(SYSLOG_MSG_MAX + 8);
+	if (data == NULL) {
+		perror("malloc");
+		goto out;
+	}
+
+	log->size = sizeof(hdr);
+	log->block_count = 0;
+	log->min_time = INT64_MAX;
+	log->max_time = INT64_MIN;
+	idents_reset(log);
+	block_reset(log);
+
+	offset = sizeof(hdr);
+	end = sb.st_size;
+
+	while (offset + sizeof(rec) <= end) {
+		if (pread(fd, &rec, sizeof(rec), offset) != sizeof(rec) ||
+		    !record_valid(&rec, end - offset)) {
+			break;
+		}
+
+		if (offset + rec.size - log->cur.offset > STORE_BLOCK_SIZE) {
+			log->cur.length = offset - log->cur.offset;
+			if (grow((void **)&log->blocks, &log->block_max,
+				 log->block_count, sizeof(log->blocks[0]))) {
+				goto out;
+			}
+			log->blocks[log->block_count++] = log->cur;
+			log->size = offset;
+			block_reset(log);
+		}
+
+		if (rec.facility == STORE_IDENT_RECORD) {
+			if (rec.length > SYSLOG_MSG_MAX ||
+			    rec.ident != log->ident_count + 1 ||
+			    pread(fd, data, rec.length, offset + sizeof(rec)) !=
+			    (ssize_t)rec.length) {
+				break;
+			}
+
+			data[rec.length] = '\0';
+			if (ident_add(log, data, rec.length,
+				      ident_hash(data)) != rec.ident) {
+				goto out;
+			}
+		} else {
+			log->cur.count += 1;
+			log->cur.ident_mask |= 1ULL << (rec.ident % 64);
+			time_range(&log->cur.min_time, &log->cur.max_time,
+				   rec.timestamp);
+			time_range(&log->min_time, &log->max_time,
+				   rec.timestamp);
+		}
+
+		offset += rec.size;
+	}
+
+	if (offset > log->cur.offset) {
+		log->cur.length = offset - log->cur.offset;
+		if (grow((void **)&log->blocks, &log->block_max,
+			 log->block_count, sizeof(log->blocks[0]))) {
+			goto out;
+		}
+		log->blocks[log->block_count++] = log->cur;
+	}
+
+	if (offset < end) {
+		fprintf(stderr, "%s: discarding %llu bytes of incomplete "
+			"data\n", name, (unsigned long long)(end - offset));
+		if (ftruncate(fd, offset))
+			perror(name);
+	}
+
+	if (fsync(fd))
+		perror(name);
+
+	ret = index_write_sealed(log, segment);
+out:
+	free(data);
+	if (fd >= 0)
+		close(fd);
+	idents_reset(log);
+	block_reset(log);
+	log->block_count = 0;
+	return ret;
+}
+
+static bool segment_sealed(unsigned int segment)
+{
+	char name[STORE_NAME_MAX];
+	store_header_t hdr;
+	bool sealed = false;
+	int fd;
+
+	segment_name(name, segment, "idx");
+
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+	    memcmp(hdr.magic, STORE_IDX_MAGIC, sizeof(hdr.magic)) == 0) {
+		sealed = (hdr.flags & STORE_SEALED) != 0;
+	}
+
+	close(fd);
+	return sealed;
+}
+
+/*
+  Find the highest segment number in use and seal segments that were
+  left open by an earlier run.
+ */
+static int store_recover(log_backend_store_t *log)
+{
+	struct dirent *ent;
+	unsigned int n;
+	char ext[4];
+	DIR *dir;
+
+	dir = opendir(".");
+	if (dir == NULL) {
+		perror("scanning for log store segments");
+		return -1;
+	}
+
+	while ((ent = readdir(dir)) != NULL) {
+		if (sscanf(ent->d_name, "store.%u.%3s", &n, ext) != 2 ||
+		    strcmp(ext, "seg") != 0) {
+			continue;
+		}
+
+		if (n > log->last_segment)
+			log->last_segment = n;
+
+		if (!segment_sealed(n)) {
+			fprintf(stderr, "store.%08u: rebuilding index\n", n);
+			segment_rebuild(log, n);
+		}
+	}
+
+	closedir(dir);
+	return 0;
+}
+
+/*****************************************************************************/
+
+static int store_backend_init(log_backend_t *backend, const log_config_t *cfg)
+{
+	log_backend_store_t *log = (log_backend_store_t *)backend;
+
+	log->maxsize = (cfg->flags & LOG_ROTATE_SIZE_LIMIT) ?
+		cfg->sizelimit : STORE_SEGMENT_MAX;
+	log->sync_mode = cfg->sync_mode;
+	log->unbuffered = cfg->buffer_size == 0;
+	log->flush_interval = cfg->flush_interval;
+	log->segment = 0;
+	log->data_fd = -1;
+	log->idx_fd = -1;
+
+	log->block = malloc(STORE_BLOCK_SIZE);
+	if (log->block == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	return store_recover(log);
+}
+
+static void store_backend_cleanup(log_backend_t *backend)
+{
+	log_backend_store_t *log = (log_backend_store_t *)backend;
+
+	segment_seal(log);
+	idents_reset(log);
+
+	free(log->table);
+	free(log->idents);
+	free(log->blocks);
+	free(log->pending);
+	free(log->block);
+	log->table = NULL;
+	log->idents = NULL;
+	log->blocks = NULL;
+	log->pending = NULL;
+	log->block = NULL;
+	log->table_size = 0;
+	log->ident_max = 0;
+	log->block_max = 0;
+	log->pending_max = 0;
+}
+
+/* Define the ident of a message in the segment, if it is not yet. */
+static uint32_t store_ident(log_backend_store_t *log, const syslog_msg_t *msg)
+{
+	store_idx_ident_t entry;
+	store_record_t rec;
+	size_t length;
+	uint32_t id;
+
+	if (msg->ident == NULL)
+		return 0;
+
+	id = ident_find(log, msg->ident, msg->ident_hash);
+	if (id != 0)
+		return id;
+
+	length = strlen(msg->ident);
+	id = ident_add(log, msg->ident, length, msg->ident_hash);
+	if (id == 0)
+		return 0;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.facility = STORE_IDENT_RECORD;
+	rec.length = length;
+	rec.ident = id;
+
+	entry.hdr.type = STORE_IDX_IDENT;
+	entry.hdr.size = STORE_ALIGN(sizeof(entry) + length);
+	entry.id = id;
+	entry.length = length;
+
+	if (record_append(log, &rec, msg->ident))
+		return 0;
+
+	if (pending_add(log, &entry, sizeof(entry), msg->ident, length))
+		return 0;
+
+	return id;
+}
+
+static int store_backend_write(log_backend_t *backend,
+			       const syslog_msg_t *msg)
+{
+	log_backend_store_t *log = (log_backend_store_t *)backend;
+	store_record_t rec;
+	size_t length;
+	bool failed;
+
+	if (log->segment == 0 && segment_open(log))
+		return -1;
+
+	length = strlen(msg->message);
+	if (length > SYSLOG_MSG_MAX)
+		length = SYSLOG_MSG_MAX;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.facility = msg->facility;
+	rec.level = msg->level;
+	rec.length = length;
+	rec.timestamp = msg->timestamp;
+	rec.pid = msg->pid;
+	rec.ident = store_ident(log, msg);
+
+	if (record_append(log, &rec, msg->message))
+		return -1;
+
+	log->messages += 1;
+	log->bytes += STORE_ALIGN(sizeof(rec) + length);
+
+	if (log->unbuffered)
+		block_flush(log);
+
+	/*
+	  After a failed write, idents defined in the lost part of the block
+	  are unknown in the file, so continue with a fresh segment.
+	 */
+	/* sealing clears the flag */
+	failed = log->failed;
+
+	if (failed || log->size + log->used >= log->maxsize)
+		segment_seal(log);
+
+	return failed ? -1 : 0;
+}
+
+static void store_backend_rotate(log_backend_t *backend)
+{
+	segment_seal((log_backend_store_t *)backend);
+}
+
+static int store_backend_tick(log_backend_t *backend)
+{
+	log_backend_store_t *log = (log_backend_store_t *)backend;
+	long long now;
+
+	if (log->used == log->written)
+		return -1;
+
+	now = now_ms();
+
+	if (now < log->flush_due)
+		return log->flush_due - now;
+
+	if (block_flush(log))
+		segment_seal(log);
+	return -1;
+}
+
+static void store_backend_stream_stats(log_backend_t *backend,
+				       log_stream_fn fn, void *user)
+{
+	log_backend_store_t *log = (log_backend_store_t *)backend;
+
+	fn(user, "store", 5, log->messages, log->bytes);
+}
+
+static log_backend_store_t storebackend = {
+	.base = {
+		.init = store_backend_init,
+		.cleanup = store_backend_cleanup,
+		.write = store_backend_write,
+		.rotate = store_backend_rotate,
+		.tick = store_backend_tick,
+		.stream_stats = store_backend_stream_stats,
+	},
+	.data_fd = -1,
+	.idx_fd = -1,
+};
+
+log_backend_t *store_backend = (log_backend_t *)&storebackend;
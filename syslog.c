@@ -1,17 +1,41 @@
 /* SPDX-License-Identifier: ISC */
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdbool.h>
+#include <unistd.h>
 #include <getopt.h>
 #include <syslog.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
+#include <time.h>
 
 #include "syslogd.h"
 
+#ifndef _PATH_LOG
+#define _PATH_LOG "/dev/log"
+#endif
+
+#ifndef _PATH_CONSOLE
+#define _PATH_CONSOLE "/dev/console"
+#endif
+
+/* number of lines sent with a single sendmmsg() call */
+#define BATCH_SIZE 64
+
+/* maximum size of a message, longer lines are truncated */
+#define MSG_MAX 4096
+
 static int facility = 1;
 static int level = LOG_INFO;
 static int flags = LOG_NDELAY | LOG_NOWAIT;
 static const char *ident = "(shell)";
+static const char *socket_path = _PATH_LOG;
+static bool use_stdin = false;
+static bool level_prefix = false;
 
 static const struct option options[] = {
 	{ "help", no_argument, NULL, 'h' },
@@ -20,14 +44,19 @@ static const struct option options[] = {
 	{ "facility", required_argument, NULL, 'f' },
 	{ "level", required_argument, NULL, 'l' },
 	{ "ident", required_argument, NULL, 'i' },
+	{ "stdin", no_argument, NULL, 's' },
+	{ "level-prefix", no_argument, NULL, 'p' },
+	{ "socket", required_argument, NULL, 'S' },
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *shortopt = "hVcf:l:i:";
+static const char *shortopt = "hVcf:l:i:spS:";
 
 static const char *helptext =
-"Usage: syslog [OPTION]... [STRING]...\n\n"
+"Usage: syslog [OPTION]... [STRING]...\n"
+"       syslog --stdin [OPTION]...\n\n"
 "Concatenate the given STRINGs and send a log message to the syslog daemon.\n"
+"With --stdin, send every line read from standard input as a message.\n"
 "\n"
 "The following OPTIONSs can be used:\n"
 "  -f, --facility <facility>  Logging facilty name or numeric identifier.\n"
@@ -36,6 +65,13 @@ static const char *helptext =
 "                             Default is \"%s\".\n\n"
 "  -c, --console              Write to the console if opening the syslog\n"
 "                             socket fails.\n\n"
+"  -s, --stdin                Read messages from standard input, one per\n"
+"                             line, and send them over a single connection.\n"
+"  -p, --level-prefix         With --stdin, a line can start with a level\n"
+"                             name or number in angle brackets, e.g. <error>\n"
+"                             or <3>, to override --level for that line.\n"
+"  -S, --socket <path>        With --stdin, the socket of the syslog daemon.\n"
+"                             Default is \"" _PATH_LOG "\".\n\n"
 "  -h, --help                 Print this help text and exit\n"
 "  -V, --version              Print version information and exit\n\n";
 
@@ -130,6 +166,15 @@ static void process_options(int argc, char **argv)
 		case 'c':
 			flags |= LOG_CONS;
 			break;
+		case 's':
+			use_stdin = true;
+			break;
+		case 'p':
+			level_prefix = true;
+			break;
+		case 'S':
+			socket_path = optarg;
+			break;
 		case 'V':
 			fputs(version_string, stdout);
 			exit(EXIT_SUCCESS);
@@ -144,6 +189,268 @@ static void process_options(int argc, char **argv)
 	}
 }
 
+/*****************************************************************************/
+
+static struct {
+	char data[BATCH_SIZE][MSG_MAX];
+	struct iovec iov[BATCH_SIZE];
+	struct mmsghdr hdr[BATCH_SIZE];
+	size_t count;
+
+	/* time stamp of the batch, formatted once per second */
+	char timestamp[32];
+	time_t timestamp_sec;
+} batch;
+
+static int log_fd = -1;
+static int console_fd = -1;
+
+static int log_connect(void)
+{
+	struct sockaddr_un un;
+
+	if (strlen(socket_path) >= sizeof(un.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", socket_path);
+		return -1;
+	}
+
+	log_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (log_fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&un, 0, sizeof(un));
+	un.sun_family = AF_UNIX;
+	strcpy(un.sun_path, socket_path);
+
+	if (connect(log_fd, (struct sockaddr *)&un, sizeof(un))) {
+		fprintf(stderr, "%s: connect: %s\n", socket_path,
+			strerror(errno));
+		close(log_fd);
+		log_fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Messages that cannot be sent go to the console if --console is set. */
+static int console_write(size_t first)
+{
+	size_t i;
+	char *msg;
+
+	if (!(flags & LOG_CONS))
+		return -1;
+
+	if (console_fd < 0) {
+		console_fd = open(_PATH_CONSOLE, O_WRONLY | O_NOCTTY |
+				  O_CLOEXEC);
+		if (console_fd < 0) {
+			perror(_PATH_CONSOLE);
+			return -1;
+		}
+	}
+
+	for (i = first; i < batch.count; ++i) {
+		/* skip the priority, like syslog() does with LOG_CONS */
+		msg = strchr(batch.data[i], '>') + 1;
+		dprintf(console_fd, "%.*s\r\n",
+			(int)(batch.iov[i].iov_len - (msg - batch.data[i])),
+			msg);
+	}
+
+	return 0;
+}
+
+static int batch_flush(void)
+{
+	bool retried = false;
+	size_t sent = 0;
+	int ret;
+
+	while (sent < batch.count) {
+		if (log_fd < 0 && (console_fd >= 0 || log_connect()))
+			goto fail;
+
+		ret = sendmmsg(log_fd, batch.hdr + sent, batch.count - sent,
+			       MSG_NOSIGNAL);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EMSGSIZE) {
+				fputs("syslog: message too long, "
+				      "dropped\n", stderr);
+				sent += 1;
+				continue;
+			}
+
+			/* the syslog daemon may have been restarted */
+			close(log_fd);
+			log_fd = -1;
+
+			if (retried)
+				goto fail;
+
+			retried = true;
+			continue;
+		}
+
+		sent += ret;
+		retried = false;
+	}
+
+	batch.count = 0;
+	return 0;
+fail:
+	ret = console_write(sent);
+	batch.count = 0;
+	return ret;
+}
+
+static int parse_level_prefix(const char **line, size_t *len)
+{
+	const char *str = *line, *end;
+	char name[16];
+	int lvl;
+
+	if (*len < 3 || str[0] != '<')
+		return level;
+
+	end = memchr(str, '>', *len < sizeof(name) ? *len : sizeof(name));
+	if (end == NULL || end == str + 1)
+		return level;
+
+	memcpy(name, str + 1, end - str - 1);
+	name[end - str - 1] = '\0';
+
+	lvl = readint(name);
+	if (lvl < 0)
+		lvl = level_id_from_string(name);
+	if (lvl < 0 || lvl > 7)
+		return level;
+
+	end += 1;
+	while (end < str + *len && *end == ' ')
+		++end;
+
+	*len -= end - str;
+	*line = end;
+	return lvl;
+}
+
+static int batch_add(const char *line, size_t len)
+{
+	char *msg = batch.data[batch.count];
+	int ret, lvl = level;
+	struct tm tm;
+	time_t now;
+
+	if (len > 0 && line[len - 1] == '\r')
+		--len;
+
+	if (level_prefix)
+		lvl = parse_level_prefix(&line, &len);
+
+	if (len == 0)
+		return 0;
+
+	now = time(NULL);
+	if (now != batch.timestamp_sec) {
+		localtime_r(&now, &tm);
+		strftime(batch.timestamp, sizeof(batch.timestamp),
+			 "%b %e %T", &tm);
+		batch.timestamp_sec = now;
+	}
+
+	ret = snprintf(msg, MSG_MAX, "<%d>%s %s: %.*s",
+		       (facility << 3) | lvl, batch.timestamp, ident,
+		       (int)len, line);
+
+	batch.iov[batch.count].iov_len = ret >= MSG_MAX ? MSG_MAX - 1 : ret;
+	batch.count += 1;
+
+	return batch.count == BATCH_SIZE ? batch_flush() : 0;
+}
+
+/*
+  Everything that a single read() returns is sent as one batch, so a
+  busy pipe is forwarded with few system calls, while lines of an
+  interactive one are sent as soon as they arrive.
+ */
+static int stream_stdin(void)
+{
+	static char buffer[65536];
+	size_t fill = 0, len;
+	bool discard = false;
+	char *ptr, *end;
+	int status = 0;
+	ssize_t ret;
+	size_t i;
+
+	for (i = 0; i < BATCH_SIZE; ++i) {
+		batch.iov[i].iov_base = batch.data[i];
+		batch.hdr[i].msg_hdr.msg_iov = batch.iov + i;
+		batch.hdr[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (;;) {
+		ret = read(STDIN_FILENO, buffer + fill, sizeof(buffer) - fill);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("reading from stdin");
+			goto fail;
+		}
+
+		if (ret == 0)
+			break;
+
+		fill += ret;
+		ptr = buffer;
+
+		while ((end = memchr(ptr, '\n', fill - (ptr - buffer)))) {
+			if (!discard && batch_add(ptr, end - ptr))
+				goto fail;
+			discard = false;
+			ptr = end + 1;
+		}
+
+		len = fill - (ptr - buffer);
+
+		/* a line that does not fit into the buffer is truncated */
+		if (len == sizeof(buffer)) {
+			if (!discard && batch_add(ptr, len))
+				goto fail;
+			discard = true;
+			len = 0;
+		}
+
+		memmove(buffer, ptr, len);
+		fill = len;
+
+		if (batch.count > 0 && batch_flush())
+			goto fail;
+	}
+
+	if (fill > 0 && !discard && batch_add(buffer, fill))
+		goto fail;
+
+	if (batch.count > 0 && batch_flush())
+		goto fail;
+out:
+	if (log_fd >= 0)
+		close(log_fd);
+	if (console_fd >= 0)
+		close(console_fd);
+	return status;
+fail:
+	status = -1;
+	goto out;
+}
 
 int main(int argc, char **argv)
 {
@@ -153,6 +460,16 @@ int main(int argc, char **argv)
 
 	process_options(argc, argv);
 
+	if (use_stdin) {
+		if (optind < argc) {
+			fputs("Error: --stdin does not accept a log string.\n",
+			      stderr);
+			usage(EXIT_FAILURE);
+		}
+
+		return stream_stdin() ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
 	if (optind >= argc) {
 		fputs("Error: no log string provided.\n", stderr);
 		usage(EXIT_FAILURE);
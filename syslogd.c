@@ -2,7 +2,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
 #include <unistd.h>
+#include <stdarg.h>
+#include <syslog.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>
@@ -15,6 +21,19 @@
 
 #include "syslogd.h"
 
+#define DEFAULT_BATCH_SIZE 16
+#define MAX_BATCH_SIZE 1024
+#define DEFAULT_BUFFER_SIZE 16384
+#define DEFAULT_FLUSH_INTERVAL 1000
+#define DEFAULT_QUEUE_SIZE 1024
+#define DEFAULT_SPOOL_SIZE (64 * 1024 * 1024)
+
+/* seconds between reports of messages discarded by the rate limit */
+#define RATELIMIT_REPORT_INTERVAL 5
+
+/* file descriptors not available to log files if --max-open isn't set */
+#define RESERVED_FDS 64
+
 static const struct option long_opts[] = {
 	{ "help", no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'V' },
@@ -23,10 +42,37 @@ static const struct option long_opts[] = {
 	{ "max-size", required_argument, NULL, 'm' },
 	{ "user", required_argument, NULL, 'u' },
 	{ "group", required_argument, NULL, 'g' },
+	{ "batch-size", required_argument, NULL, 'b' },
+	{ "sync", required_argument, NULL, 's' },
+	{ "sync-count", required_argument, NULL, 'n' },
+	{ "sync-interval", required_argument, NULL, 't' },
+	{ "sync-urgent", no_argument, NULL, 'U' },
+	{ "buffer-size", required_argument, NULL, 'B' },
+	{ "flush-interval", required_argument, NULL, 'F' },
+	{ "max-open", required_argument, NULL, 'o' },
+	{ "threaded", no_argument, NULL, 'T' },
+	{ "queue-size", required_argument, NULL, 'q' },
+	{ "backend", required_argument, NULL, 'e' },
+	{ "socket", required_argument, NULL, 'S' },
+	{ "log-dir", required_argument, NULL, 'd' },
+	{ "config", required_argument, NULL, 'f' },
+	{ "rcvbuf", required_argument, NULL, 'R' },
+	{ "stats-socket", required_argument, NULL, 'C' },
+	{ "rate-limit", required_argument, NULL, 'l' },
+	{ "rate-burst", required_argument, NULL, 'L' },
+	{ "rate-key", required_argument, NULL, 'k' },
+	{ "compress", required_argument, NULL, 'z' },
+	{ "preallocate", required_argument, NULL, 'P' },
+	{ "keep", required_argument, NULL, 'K' },
+	{ "max-age", required_argument, NULL, 'A' },
+	{ "keep-size", required_argument, NULL, 'M' },
+	{ "disk-budget", required_argument, NULL, 'D' },
+	{ "forward", required_argument, NULL, 'w' },
+	{ "spool-size", required_argument, NULL, 'W' },
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *short_opts = "hVcrm:u:g:";
+static const char *short_opts = "hVcrm:u:g:b:s:n:t:UB:F:o:Tq:e:S:d:f:R:C:l:L:k:z:P:K:A:M:D:w:W:";
 
 const char *usage_string =
 "Usage: usyslogd [OPTIONS..]\n\n"
@@ -39,17 +85,164 @@ const char *usage_string =
 "                         try to use the user '" DEFAULT_USER "'.\n"
 "  -g, --group <name>     Run the syslog daemon as this group. If not set,\n"
 "                         try to use the group '" DEFAULT_GROUP "'.\n"
-"  -c, --chroot           If set, do a chroot into the log file path.\n";
+"  -c, --chroot           If set, do a chroot into the log file path.\n"
+"  -b, --batch-size <count>\n"
+"                         Receive up to this many messages from the socket\n"
+"                         with a single system call. Default is %d.\n"
+"  -s, --sync <mode>      How to flush log data to disk. Either 'full'\n"
+"                         (fsync, the default), 'data' (fdatasync) or\n"
+"                         'none' (leave it to the kernel).\n"
+"  -n, --sync-count <count>\n"
+"                         Only flush after this many messages.\n"
+"  -t, --sync-interval <milliseconds>\n"
+"                         Flush at the latest this long after a message\n"
+"                         was written. If neither this nor --sync-count\n"
+"                         are set, log data is flushed after every message.\n"
+"  -U, --sync-urgent      Always immediately flush messages with level\n"
+"                         critical or above.\n"
+"  -B, --buffer-size <bytes>\n"
+"                         Size of the write buffer for each log file.\n"
+"                         0 disables buffering. Default is %d.\n"
+"  -F, --flush-interval <milliseconds>\n"
+"                         Write out buffered messages at the latest after\n"
+"                         this long. Default is %d.\n"
+"  -o, --max-open <count> Maximum number of log files kept open at the\n"
+"                         same time. The least recently used ones are\n"
+"                         closed if necessary. 0 means no limit. Default\n"
+"                         is based on the open file limit of the process.\n"
+"  -P, --preallocate <bytes>\n"
+"                         Reserve disk space for log files in chunks of\n"
+"                         this size, up to the --max-size limit, so they\n"
+"                         are not extended on every write. Unused space is\n"
+"                         released when a file is rotated or closed.\n"
+"  -T, --threaded         Receive and parse messages in a separate thread\n"
+"                         that hands them over to the writing thread\n"
+"                         through a queue, so a slow disk does not stall\n"
+"                         the syslog socket.\n"
+"  -q, --queue-size <count>\n"
+"                         Number of messages that the queue between the\n"
+"                         threads can hold. If it is full, messages are\n"
+"                         dropped. Default is %d.\n"
+"  -e, --backend <name>   How log files are written. Either 'file'\n"
+"                         (synchronous system calls, the default) or\n"
+"                         'uring' (asynchronous through io_uring, falls\n"
+"                         back to 'file' if io_uring is not available).\n"
+"                         Alternatively, 'store' writes an indexed binary\n"
+"                         log store that can be read with logquery, and\n"
+"                         'forward' only forwards messages, see --forward.\n"
+"  -S, --socket <path>    Receive messages on this socket instead of\n"
+"                         " SYSLOG_SOCKET ".\n"
+"  -d, --log-dir <path>   Write log files to this directory instead of\n"
+"                         " SYSLOG_PATH ".\n"
+"  -f, --config <path>    Route messages according to the rules in this\n"
+"                         file. Reloaded on SIGUSR2.\n"
+"  -C, --stats-socket <path>\n"
+"                         Serve runtime statistics on a unix stream socket\n"
+"                         at this path. Send 'prometheus' after connecting\n"
+"                         for Prometheus style output instead of text.\n"
+"                         Statistics are also printed on SIGUSR1.\n";
+
+/* the help text is split by topic, each printed with its own defaults */
+static const char *input_usage_string =
+"\nReceiving messages:\n"
+"  -R, --rcvbuf <bytes>   Set the receive buffer size of the socket. Note\n"
+"                         that the number of queued datagrams is also\n"
+"                         limited by the net.unix.max_dgram_qlen sysctl.\n"
+"  -l, --rate-limit <count>\n"
+"                         Accept at most this many messages per second\n"
+"                         from each sender, discard the rest and report\n"
+"                         the number discarded every %d seconds.\n"
+"  -L, --rate-burst <count>\n"
+"                         Number of messages a sender can send at once\n"
+"                         before the rate limit applies. Default is the\n"
+"                         rate limit, i.e. one second worth of messages.\n"
+"  -k, --rate-key <key>   Apply the rate limit per 'pid' (the default) or\n"
+"                         per 'uid'.\n";
+
+static const char *archive_usage_string =
+"\nRotated log files:\n"
+"  -z, --compress <method>\n"
+"                         Compress rotated log files in the background\n"
+"                         with 'gzip' or 'zstd', if support for it was\n"
+"                         compiled in. Default is 'none'.\n"
+"  -K, --keep <count>     Keep at most this many rotated files per log\n"
+"                         file, removing the oldest ones.\n"
+"  -A, --max-age <seconds>\n"
+"                         Remove rotated log files older than this.\n"
+"  -M, --keep-size <bytes>\n"
+"                         Remove the oldest rotated files of a log file\n"
+"                         once they take up more than this in total.\n"
+"  -D, --disk-budget <bytes>\n"
+"                         Limit the size of all log files together by\n"
+"                         removing rotated files, oldest first, from the\n"
+"                         log files that take up more than their share.\n";
+
+static const char *forward_usage_string =
+"\nForwarding:\n"
+"  -w, --forward <address>\n"
+"                         Also forward messages to a remote collector at\n"
+"                         'udp://host[:port]' or 'tcp://host[:port]'.\n"
+"                         With --config, only messages routed to the\n"
+"                         'forward' backend are forwarded.\n"
+"  -W, --spool-size <bytes>\n"
+"                         Keep at most this many bytes of messages that\n"
+"                         could not be forwarded yet in a file in the log\n"
+"                         directory. 0 drops them instead. Default is\n"
+"                         %d.\n";
 
 
 
 static volatile sig_atomic_t syslog_run = 1;
 static volatile sig_atomic_t syslog_rotate = 0;
-static int log_flags = 0;
-static size_t max_size = 0;
+static volatile sig_atomic_t syslog_dump = 0;
+static volatile sig_atomic_t syslog_reload = 0;
+static log_config_t log_cfg = {
+	.flags = 0,
+	.sizelimit = 0,
+	.sync_mode = LOG_SYNC_FULL,
+	.buffer_size = DEFAULT_BUFFER_SIZE,
+	.flush_interval = DEFAULT_FLUSH_INTERVAL,
+	.spool_size = DEFAULT_SPOOL_SIZE,
+};
 static uid_t uid = 0;
 static gid_t gid = 0;
 static bool dochroot = false;
+static const char *socket_path = SYSLOG_SOCKET;
+static const char *log_path = SYSLOG_PATH;
+static const char *config_path = NULL;
+static int batch_size = DEFAULT_BATCH_SIZE;
+static bool threaded = false;
+static size_t queue_size = DEFAULT_QUEUE_SIZE;
+static int rcvbuf = 0;
+static const char *stats_path = NULL;
+static int stats_fd = -1;
+static unsigned int rate_limit = 0;
+static unsigned int rate_burst = 0;
+static bool rate_by_uid = false;
+static int compress_method = COMPRESS_NONE;
+static retention_t retention;
+
+static char *rx_slab = NULL;
+static struct iovec *rx_iov = NULL;
+static struct mmsghdr *rx_hdr = NULL;
+static syslog_msg_t *rx_msg = NULL;
+static char *rx_ctrl = NULL;
+
+/* space for the SO_RXQ_OVFL drop counter and credentials of a datagram */
+#define RX_CTRL_SIZE (CMSG_SPACE(sizeof(uint32_t)) + \
+		      CMSG_SPACE(sizeof(struct ucred)))
+
+/* last value of the SO_RXQ_OVFL drop counter */
+static uint32_t rx_ovfl_last = 0;
+
+static ratelimit_t rx_limit;
+static time_t rx_report_time = 0;
+
+static msgring_t rx_ring;
+static int rx_stop_fd = -1;
+static uint64_t queue_drops_reported = 0;
+static uint64_t kernel_drops_reported = 0;
+static time_t drops_report_time = 0;
 
 
 
@@ -63,6 +256,12 @@ static void sighandler(int signo)
 	case SIGHUP:
 		syslog_rotate = 1;
 		break;
+	case SIGUSR1:
+		syslog_dump = 1;
+		break;
+	case SIGUSR2:
+		syslog_reload = 1;
+		break;
 	default:
 		break;
 	}
@@ -78,26 +277,621 @@ static void signal_setup(void)
 	sigaction(SIGINT, &act, NULL);
 	sigaction(SIGTERM, &act, NULL);
 	sigaction(SIGHUP, &act, NULL);
+	sigaction(SIGUSR1, &act, NULL);
+	sigaction(SIGUSR2, &act, NULL);
 }
 
-static int handle_data(int fd)
+static int rx_setup(void)
+{
+	int i;
+
+	rx_slab = malloc((size_t)batch_size * SYSLOG_MSG_MAX);
+	rx_iov = calloc(batch_size, sizeof(rx_iov[0]));
+	rx_hdr = calloc(batch_size, sizeof(rx_hdr[0]));
+	rx_msg = calloc(batch_size, sizeof(rx_msg[0]));
+	rx_ctrl = calloc(batch_size, RX_CTRL_SIZE);
+
+	if (rx_slab == NULL || rx_iov == NULL ||
+	    rx_hdr == NULL || rx_msg == NULL || rx_ctrl == NULL) {
+		perror("allocating receive buffers");
+		return -1;
+	}
+
+	for (i = 0; i < batch_size; ++i) {
+		/* leave room for a null terminator after the datagram */
+		rx_iov[i].iov_base = rx_slab + (size_t)i * SYSLOG_MSG_MAX;
+		rx_iov[i].iov_len = SYSLOG_MSG_MAX - 1;
+
+		rx_hdr[i].msg_hdr.msg_iov = rx_iov + i;
+		rx_hdr[i].msg_hdr.msg_iovlen = 1;
+		rx_hdr[i].msg_hdr.msg_control = rx_ctrl +
+			(size_t)i * RX_CTRL_SIZE;
+	}
+
+	if (rate_limit > 0 &&
+	    ratelimit_init(&rx_limit, rate_limit, rate_burst, rate_by_uid)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the kernel overwrites the control lengths on every receive */
+static void rx_reset_control(int count)
+{
+	int i;
+
+	for (i = 0; i < count; ++i)
+		rx_hdr[i].msg_hdr.msg_controllen = RX_CTRL_SIZE;
+}
+
+/*
+  SO_RXQ_OVFL attaches the running total of datagrams the kernel dropped
+  on the socket, as of the time a datagram was queued. Only the newest
+  value in a batch matters.
+ */
+static void rx_account_drops(int count)
+{
+	struct cmsghdr *cmsg;
+	uint32_t value;
+	int i;
+
+	for (i = count - 1; i >= 0; --i) {
+		cmsg = CMSG_FIRSTHDR(&rx_hdr[i].msg_hdr);
+
+		for (; cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&rx_hdr[i].msg_hdr, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET ||
+			    cmsg->cmsg_type != SO_RXQ_OVFL)
+				continue;
+
+			memcpy(&value, CMSG_DATA(cmsg), sizeof(value));
+
+			if (value != rx_ovfl_last) {
+				STATS_ADD(stats.kernel_drops,
+					  (uint32_t)(value - rx_ovfl_last));
+				rx_ovfl_last = value;
+			}
+			return;
+		}
+	}
+}
+
+static long long rx_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000L;
+}
+
+/*
+  Apply the per sender rate limit to the i-th received datagram, based
+  on the credentials the kernel attached to it.
+ */
+static bool rx_allowed(int i, long long now)
+{
+	struct cmsghdr *cmsg;
+	struct ucred cred;
+
+	for (cmsg = CMSG_FIRSTHDR(&rx_hdr[i].msg_hdr); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&rx_hdr[i].msg_hdr, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_CREDENTIALS)
+			continue;
+
+		memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+
+		if (ratelimit_check(&rx_limit, cred.pid, cred.uid, now))
+			return true;
+
+		STATS_ADD(stats.ratelimited, 1);
+		return false;
+	}
+
+	return true;
+}
+
+/* Check whether discarded messages should be reported now. */
+static bool rx_report_due(bool force)
+{
+	time_t now;
+
+	if (rate_limit == 0)
+		return false;
+
+	now = time(NULL);
+	if (!force && now - rx_report_time < RATELIMIT_REPORT_INTERVAL)
+		return false;
+
+	rx_report_time = now;
+	return true;
+}
+
+static void rx_cleanup(void)
+{
+	free(rx_slab);
+	free(rx_iov);
+	free(rx_hdr);
+	free(rx_msg);
+	free(rx_ctrl);
+	ratelimit_cleanup(&rx_limit);
+}
+
+/* Fill in a message generated by the syslog daemon itself. */
+static void init_internal(syslog_msg_t *msg, int level, const char *text)
 {
-	char buffer[2048];
+	memset(msg, 0, sizeof(*msg));
+	msg->facility = LOG_FAC(LOG_SYSLOG);
+	msg->level = level;
+	msg->timestamp = time(NULL);
+	msg->pid = getpid();
+	msg->ident = "usyslogd";
+	msg->ident_hash = ident_hash(msg->ident);
+	msg->message = text;
+}
+
+/* Write a message generated by the syslog daemon itself. */
+static void log_internal(int level, const char *fmt, ...)
+{
+	char buffer[256];
 	syslog_msg_t msg;
-	ssize_t ret;
+	va_list ap;
 
-	memset(buffer, 0, sizeof(buffer));
+	va_start(ap, fmt);
+	vsnprintf(buffer, sizeof(buffer), fmt, ap);
+	va_end(ap);
+
+	init_internal(&msg, level, buffer);
+	logmgr->write(logmgr, &msg);
+}
 
-	ret = read(fd, buffer, sizeof(buffer));
-	if (ret <= 0)
+static void suppressed_text(char *buffer, size_t size,
+			    const ratelimit_entry_t *e, uint64_t count)
+{
+	if (e == NULL) {
+		snprintf(buffer, size, "suppressed %llu messages from "
+			 "other senders", (unsigned long long)count);
+	} else if (rx_limit.by_uid) {
+		snprintf(buffer, size, "suppressed %llu messages from uid %u",
+			 (unsigned long long)count, (unsigned int)e->uid);
+	} else {
+		snprintf(buffer, size, "suppressed %llu messages from pid %d "
+			 "(uid %u)", (unsigned long long)count, (int)e->pid,
+			 (unsigned int)e->uid);
+	}
+}
+
+/* ratelimit_report() callback that writes to the backend directly */
+static void suppressed_log(void *user, const ratelimit_entry_t *e,
+			   uint64_t count)
+{
+	char buffer[128];
+	syslog_msg_t msg;
+
+	suppressed_text(buffer, sizeof(buffer), e, count);
+	init_internal(&msg, LOG_WARNING, buffer);
+	logmgr->write(logmgr, &msg);
+	(void)user;
+}
+
+/* ratelimit_report() callback for the receiver thread, fills queue slots */
+static void suppressed_queue(void *user, const ratelimit_entry_t *e,
+			     uint64_t count)
+{
+	size_t *used = user;
+	msg_slot_t *slot;
+
+	if (*used >= msgring_space(&rx_ring)) {
+		msgring_drop(&rx_ring, 1);
+		return;
+	}
+
+	slot = msgring_producer_slot(&rx_ring, (*used)++);
+	suppressed_text(slot->data, sizeof(slot->data), e, count);
+	init_internal(&slot->msg, LOG_WARNING, slot->data);
+	slot->valid = true;
+}
+
+static void rx_report_queue(bool force)
+{
+	size_t used = 0;
+
+	if (!rx_report_due(force))
+		return;
+
+	ratelimit_report(&rx_limit, suppressed_queue, &used);
+	msgring_publish(&rx_ring, used);
+}
+
+static int handle_data(int fd)
+{
+	int i, count, parsed = 0;
+	long long now = 0;
+	char *buffer;
+
+	/*
+	  Block until at least one datagram is available, then drain
+	  whatever else is already queued without blocking again.
+	 */
+	rx_reset_control(batch_size);
+
+	count = recvmmsg(fd, rx_hdr, batch_size, MSG_WAITFORONE, NULL);
+	if (count <= 0)
 		return -1;
 
-	if (syslog_msg_parse(&msg, buffer))
+	rx_account_drops(count);
+
+	syslog_clock_update(time(NULL));
+
+	if (rate_limit > 0)
+		now = rx_now_ms();
+
+	for (i = 0; i < count; ++i) {
+		if (rate_limit > 0 && !rx_allowed(i, now))
+			continue;
+
+		buffer = rx_iov[i].iov_base;
+		buffer[rx_hdr[i].msg_len] = '\0';
+
+		if (syslog_msg_parse(rx_msg + parsed, buffer) == 0) {
+			stats_message(rx_msg + parsed, rx_hdr[i].msg_len);
+			++parsed;
+		} else {
+			STATS_ADD(stats.parse_errors, 1);
+		}
+	}
+
+	for (i = 0; i < parsed; ++i)
+		logmgr->write(logmgr, rx_msg + i);
+
+	return 0;
+}
+
+/*****************************************************************************/
+
+static void *receiver_main(void *arg)
+{
+	struct pollfd pfd[2];
+	long long now = 0;
+	msg_slot_t *slot;
+	int i, count;
+	size_t space;
+
+	pfd[0].fd = *((int *)arg);
+	pfd[0].events = POLLIN;
+	pfd[1].fd = rx_stop_fd;
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		rx_report_queue(false);
+
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
+
+		/* wake up regularly to report rate limited senders */
+		if (poll(pfd, 2, rate_limit > 0 ? 1000 : -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		if (pfd[1].revents & POLLIN)
+			break;
+
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+
+		space = msgring_space(&rx_ring);
+		if (space > (size_t)batch_size)
+			space = batch_size;
+
+		if (space == 0) {
+			/* queue is full, drain the socket into the slab */
+			for (i = 0; i < batch_size; ++i) {
+				rx_iov[i].iov_base = rx_slab +
+					(size_t)i * SYSLOG_MSG_MAX;
+			}
+
+			rx_reset_control(batch_size);
+
+			count = recvmmsg(pfd[0].fd, rx_hdr, batch_size,
+					 MSG_DONTWAIT, NULL);
+			if (count > 0) {
+				rx_account_drops(count);
+				msgring_drop(&rx_ring, count);
+			}
+			continue;
+		}
+
+		for (i = 0; i < (int)space; ++i) {
+			slot = msgring_producer_slot(&rx_ring, i);
+			rx_iov[i].iov_base = slot->data;
+		}
+
+		rx_reset_control(space);
+
+		count = recvmmsg(pfd[0].fd, rx_hdr, space, MSG_DONTWAIT, NULL);
+		if (count <= 0)
+			continue;
+
+		rx_account_drops(count);
+
+		syslog_clock_update(time(NULL));
+
+		if (rate_limit > 0)
+			now = rx_now_ms();
+
+		for (i = 0; i < count; ++i) {
+			slot = msgring_producer_slot(&rx_ring, i);
+
+			if (rate_limit > 0 && !rx_allowed(i, now)) {
+				slot->valid = false;
+				continue;
+			}
+
+			slot->data[rx_hdr[i].msg_len] = '\0';
+			slot->valid = syslog_msg_parse(&slot->msg,
+						       slot->data) == 0;
+
+			if (slot->valid) {
+				stats_message(&slot->msg, rx_hdr[i].msg_len);
+			} else {
+				STATS_ADD(stats.parse_errors, 1);
+			}
+		}
+
+		msgring_publish(&rx_ring, count);
+	}
+
+	rx_report_queue(true);
+	return NULL;
+}
+
+/*
+  Log the number of messages dropped since the last report, at most
+  once per second, along with the rate and the total so far.
+ */
+static void report_drops(bool force)
+{
+	uint64_t queue = __atomic_load_n(&rx_ring.drops, __ATOMIC_RELAXED);
+	uint64_t kernel = __atomic_load_n(&stats.kernel_drops, __ATOMIC_RELAXED);
+	uint64_t count;
+	time_t now, elapsed;
+
+	now = time(NULL);
+	if (!force && now == drops_report_time)
+		return;
+
+	elapsed = now > drops_report_time ? now - drops_report_time : 1;
+	drops_report_time = now;
+
+	if (queue != queue_drops_reported) {
+		count = queue - queue_drops_reported;
+
+		log_internal(LOG_WARNING, "dropped %llu messages, queue full "
+			     "(%zu slots, %llu/s, %llu in total)",
+			     (unsigned long long)count, rx_ring.mask + 1,
+			     (unsigned long long)(count / elapsed),
+			     (unsigned long long)queue);
+		queue_drops_reported = queue;
+	}
+
+	if (kernel != kernel_drops_reported) {
+		count = kernel - kernel_drops_reported;
+
+		log_internal(LOG_WARNING, "kernel dropped %llu messages, "
+			     "socket buffer full (%llu/s, %llu in total)",
+			     (unsigned long long)count,
+			     (unsigned long long)(count / elapsed),
+			     (unsigned long long)kernel);
+		kernel_drops_reported = kernel;
+	}
+}
+
+static void handle_reload_signal(void)
+{
+	if (!syslog_reload)
+		return;
+
+	syslog_reload = 0;
+
+	if (logmgr->reload == NULL)
+		return;
+
+	/* the file is outside the chroot, see rules_backend_create */
+	if (dochroot) {
+		log_internal(LOG_WARNING, "cannot reload %s after chroot, "
+			     "restart the daemon instead", config_path);
+		return;
+	}
+
+	if (logmgr->reload(logmgr)) {
+		log_internal(LOG_ERR, "reloading %s failed, keeping the "
+			     "previous configuration", config_path);
+	} else {
+		log_internal(LOG_NOTICE, "reloaded %s", config_path);
+	}
+}
+
+/* Combine two poll timeouts, where -1 means none. */
+static int min_timeout(int a, int b)
+{
+	if (a < 0 || (b >= 0 && b < a))
+		return b;
+	return a;
+}
+
+static void handle_stats_signal(msgring_t *ring)
+{
+	if (!syslog_dump)
+		return;
+
+	syslog_dump = 0;
+	stats_dump(stderr, STATS_FORMAT_TEXT, ring);
+	fflush(stderr);
+}
+
+static int run_threaded(int sfd)
+{
+	sigset_t mask, oldmask;
+	pthread_t receiver;
+	size_t i, count;
+	msg_slot_t *slot;
+	time_t stats_check_time = 0;
+	uint64_t one = 1;
+	int ret, timeout;
+
+	if (msgring_init(&rx_ring, queue_size))
 		return -1;
 
-	return logmgr->write(logmgr, &msg);
+	rx_stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (rx_stop_fd < 0) {
+		perror("eventfd");
+		goto fail_ring;
+	}
+
+	/* the receiver thread should never see any signals */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+	ret = pthread_create(&receiver, NULL, receiver_main, &sfd);
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+	if (ret != 0) {
+		fprintf(stderr, "creating receiver thread: %s\n",
+			strerror(ret));
+		goto fail_efd;
+	}
+
+	while (syslog_run) {
+		if (syslog_rotate) {
+			logmgr->rotate(logmgr);
+			syslog_rotate = 0;
+		}
+
+		report_drops(false);
+		handle_stats_signal(&rx_ring);
+		handle_reload_signal();
+
+		count = msgring_available(&rx_ring);
+
+		if (count == 0) {
+			timeout = min_timeout(logmgr->tick(logmgr),
+					      stats_tick(&rx_ring));
+			if (timeout < 0 || timeout > 1000)
+				timeout = 1000;
+
+			if (msgring_wait(&rx_ring, timeout, stats_fd))
+				stats_serve(stats_fd, &rx_ring);
+			continue;
+		}
+
+		/*
+		  Under load, the queue never runs empty, so check for
+		  statistics clients once per second. The listening
+		  socket is non-blocking.
+		 */
+		if (stats_fd >= 0 && time(NULL) != stats_check_time) {
+			stats_check_time = time(NULL);
+			stats_serve(stats_fd, &rx_ring);
+		} else {
+			stats_tick(&rx_ring);
+		}
+
+		for (i = 0; i < count; ++i) {
+			slot = msgring_consumer_slot(&rx_ring, i);
+			if (slot->valid)
+				logmgr->write(logmgr, &slot->msg);
+		}
+
+		msgring_release(&rx_ring, count);
+		logmgr->tick(logmgr);
+	}
+
+	if (write(rx_stop_fd, &one, sizeof(one)) < 0)
+		perror("eventfd write");
+
+	pthread_join(receiver, NULL);
+
+	/* write out whatever the receiver queued up before stopping */
+	count = msgring_available(&rx_ring);
+
+	for (i = 0; i < count; ++i) {
+		slot = msgring_consumer_slot(&rx_ring, i);
+		if (slot->valid)
+			logmgr->write(logmgr, &slot->msg);
+	}
+
+	msgring_release(&rx_ring, count);
+	report_drops(true);
+
+	fprintf(stderr, "usyslogd: message queue high water mark: %zu of "
+		"%zu, %llu dropped, %llu dropped by the kernel\n",
+		rx_ring.high_water, rx_ring.mask + 1,
+		(unsigned long long)rx_ring.drops,
+		(unsigned long long)stats.kernel_drops);
+
+	close(rx_stop_fd);
+	msgring_cleanup(&rx_ring);
+	return 0;
+fail_efd:
+	close(rx_stop_fd);
+fail_ring:
+	msgring_cleanup(&rx_ring);
+	return -1;
+}
+
+static void run_single_threaded(int sfd)
+{
+	struct pollfd pfd[2];
+	int timeout;
+
+	pfd[0].fd = sfd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = stats_fd;
+	pfd[1].events = POLLIN;
+
+	while (syslog_run) {
+		if (syslog_rotate) {
+			logmgr->rotate(logmgr);
+			syslog_rotate = 0;
+		}
+
+		report_drops(false);
+		handle_stats_signal(NULL);
+		handle_reload_signal();
+
+		if (rx_report_due(false))
+			ratelimit_report(&rx_limit, suppressed_log, NULL);
+
+		timeout = min_timeout(logmgr->tick(logmgr), stats_tick(NULL));
+
+		/* wake up regularly to report rate limited senders */
+		if (rate_limit > 0 && (timeout < 0 || timeout > 1000))
+			timeout = 1000;
+
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
+
+		if (poll(pfd, stats_fd >= 0 ? 2 : 1, timeout) <= 0)
+			continue;
+
+		if (pfd[0].revents & POLLIN)
+			handle_data(sfd);
+
+		if (pfd[1].revents & POLLIN)
+			stats_serve(stats_fd, NULL);
+	}
+
+	if (rx_report_due(true))
+		ratelimit_report(&rx_limit, suppressed_log, NULL);
+
+	report_drops(true);
 }
 
+/*****************************************************************************/
+
 static const char *version_string =
 "usyslogd (usyslog) " PACKAGE_VERSION "\n"
 "Copyright (C) 2018 David Oberhollenzer\n\n"
@@ -108,6 +902,8 @@ static void process_options(int argc, char **argv)
 {
 	struct passwd *pw = getpwnam(DEFAULT_USER);
 	struct group *grp = getgrnam(DEFAULT_GROUP);
+	bool max_open_set = false;
+	struct rlimit rl;
 	char *end;
 	int i;
 
@@ -124,12 +920,12 @@ static void process_options(int argc, char **argv)
 
 		switch (i) {
 		case 'r':
-			log_flags |= LOG_ROTATE_OVERWRITE;
+			log_cfg.flags |= LOG_ROTATE_OVERWRITE;
 			break;
 		case 'm':
-			log_flags |= LOG_ROTATE_SIZE_LIMIT;
-			max_size = strtol(optarg, &end, 10);
-			if (max_size == 0 || *end != '\0') {
+			log_cfg.flags |= LOG_ROTATE_SIZE_LIMIT;
+			log_cfg.sizelimit = strtol(optarg, &end, 10);
+			if (log_cfg.sizelimit == 0 || *end != '\0') {
 				fputs("Numeric argument > 0 expected for -m\n",
 				      stderr);
 				goto fail;
@@ -157,8 +953,204 @@ static void process_options(int argc, char **argv)
 		case 'c':
 			dochroot = true;
 			break;
+		case 'b':
+			batch_size = strtol(optarg, &end, 10);
+			if (batch_size < 1 || batch_size > MAX_BATCH_SIZE ||
+			    *end != '\0') {
+				fprintf(stderr, "Number between 1 and %d "
+					"expected for -b\n", MAX_BATCH_SIZE);
+				goto fail;
+			}
+			break;
+		case 's':
+			if (strcmp(optarg, "full") == 0) {
+				log_cfg.sync_mode = LOG_SYNC_FULL;
+			} else if (strcmp(optarg, "data") == 0) {
+				log_cfg.sync_mode = LOG_SYNC_DATA;
+			} else if (strcmp(optarg, "none") == 0) {
+				log_cfg.sync_mode = LOG_SYNC_NONE;
+			} else {
+				fprintf(stderr, "Unknown sync mode '%s'\n",
+					optarg);
+				goto fail;
+			}
+			break;
+		case 'n':
+			log_cfg.sync_count = strtoul(optarg, &end, 10);
+			if (log_cfg.sync_count == 0 || *end != '\0') {
+				fputs("Numeric argument > 0 expected for -n\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 't':
+			log_cfg.sync_interval = strtoul(optarg, &end, 10);
+			if (log_cfg.sync_interval == 0 || *end != '\0') {
+				fputs("Numeric argument > 0 expected for -t\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 'U':
+			log_cfg.sync_urgent = true;
+			break;
+		case 'B':
+			log_cfg.buffer_size = strtoul(optarg, &end, 10);
+			if (*end != '\0') {
+				fputs("Numeric argument expected for -B\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 'F':
+			log_cfg.flush_interval = strtoul(optarg, &end, 10);
+			if (*end != '\0') {
+				fputs("Numeric argument expected for -F\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 'o':
+			log_cfg.max_open = strtoul(optarg, &end, 10);
+			if (*end != '\0') {
+				fputs("Numeric argument expected for -o\n",
+				      stderr);
+				goto fail;
+			}
+			max_open_set = true;
+			break;
+		case 'P':
+			log_cfg.prealloc = strtoul(optarg, &end, 10);
+			if (*end != '\0') {
+				fputs("Numeric argument expected for -P\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 'T':
+			threaded = true;
+			break;
+		case 'q':
+			queue_size = strtoul(optarg, &end, 10);
+			if (queue_size == 0 || *end != '\0') {
+				fputs("Numeric argument > 0 expected for -q\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 'e':
+			logmgr = log_backend_by_name(optarg);
+			if (logmgr == NULL) {
+				fprintf(stderr, "Unknown backend '%s'\n",
+					optarg);
+				goto fail;
+			}
+			break;
+		case 'S':
+			socket_path = optarg;
+			break;
+		case 'd':
+			log_path = optarg;
+			break;
+		case 'f':
+			config_path = optarg;
+			break;
+		case 'C':
+			stats_path = optarg;
+			break;
+		case 'l':
+			rate_limit = strtoul(optarg, &end, 10);
+			if (rate_limit == 0 || *end != '\0') {
+				fputs("Numeric argument > 0 expected for -l\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 'L':
+			rate_burst = strtoul(optarg, &end, 10);
+			if (rate_burst == 0 || *end != '\0') {
+				fputs("Numeric argument > 0 expected for -L\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 'k':
+			if (strcmp(optarg, "pid") == 0) {
+				rate_by_uid = false;
+			} else if (strcmp(optarg, "uid") == 0) {
+				rate_by_uid = true;
+			} else {
+				fprintf(stderr, "Unknown rate limit key '%s'\n",
+					optarg);
+				goto fail;
+			}
+			break;
+		case 'z':
+			compress_method = compress_method_from_string(optarg);
+			if (compress_method < 0) {
+				fprintf(stderr, "Unknown or unsupported "
+					"compression method '%s'\n", optarg);
+				goto fail;
+			}
+			break;
+		case 'K':
+			retention.count = strtoul(optarg, &end, 10);
+			if (retention.count == 0 || *end != '\0') {
+				fputs("Numeric argument > 0 expected for -K\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 'A':
+			retention.max_age = strtoul(optarg, &end, 10);
+			if (retention.max_age == 0 || *end != '\0') {
+				fputs("Numeric argument > 0 expected for -A\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 'M':
+			retention.bytes = strtoull(optarg, &end, 10);
+			if (retention.bytes == 0 || *end != '\0') {
+				fputs("Numeric argument > 0 expected for -M\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 'D':
+			retention.budget = strtoull(optarg, &end, 10);
+			if (retention.budget == 0 || *end != '\0') {
+				fputs("Numeric argument > 0 expected for -D\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 'w':
+			log_cfg.forward_to = optarg;
+			break;
+		case 'W':
+			log_cfg.spool_size = strtoul(optarg, &end, 10);
+			if (*end != '\0') {
+				fputs("Numeric argument expected for -W\n",
+				      stderr);
+				goto fail;
+			}
+			break;
+		case 'R':
+			rcvbuf = strtol(optarg, &end, 10);
+			if (rcvbuf <= 0 || *end != '\0') {
+				fputs("Numeric argument > 0 expected for -R\n",
+				      stderr);
+				goto fail;
+			}
+			break;
 		case 'h':
-			fputs(usage_string, stdout);
+			printf(usage_string, DEFAULT_BATCH_SIZE,
+			       DEFAULT_BUFFER_SIZE, DEFAULT_FLUSH_INTERVAL,
+			       DEFAULT_QUEUE_SIZE);
+			printf(input_usage_string, RATELIMIT_REPORT_INTERVAL);
+			fputs(archive_usage_string, stdout);
+			printf(forward_usage_string, DEFAULT_SPOOL_SIZE);
 			exit(EXIT_SUCCESS);
 		case 'V':
 			fputs(version_string, stdout);
@@ -167,6 +1159,18 @@ static void process_options(int argc, char **argv)
 			goto fail;
 		}
 	}
+
+	if (rate_limit > 0 && rate_burst == 0)
+		rate_burst = rate_limit;
+
+	if (!max_open_set && getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+	    rl.rlim_cur != RLIM_INFINITY) {
+		if (rl.rlim_cur > 2 * RESERVED_FDS) {
+			log_cfg.max_open = rl.rlim_cur - RESERVED_FDS;
+		} else {
+			log_cfg.max_open = rl.rlim_cur / 2;
+		}
+	}
 	return;
 fail:
 	fputs("Try `usyslogd --help' for more information\n", stderr);
@@ -175,10 +1179,10 @@ fail:
 
 static int chroot_setup(void)
 {
-	size_t i, len = strlen(SYSLOG_PATH);
+	size_t i, len = strlen(log_path);
 	char *buffer = alloca(len + 1);
 
-	memcpy(buffer, SYSLOG_PATH, len + 1);
+	memcpy(buffer, log_path, len + 1);
 
 	for (i = 0; i <= len && buffer[i] == '/'; ++i)
 		;
@@ -199,23 +1203,24 @@ static int chroot_setup(void)
 		}
 	}
 
-	if (uid > 0 && gid > 0 && chown(SYSLOG_PATH, uid, gid) != 0) {
-		perror("chown " SYSLOG_PATH);
+	if (uid > 0 && gid > 0 && chown(log_path, uid, gid) != 0) {
+		fprintf(stderr, "chown %s: %s\n", log_path, strerror(errno));
 		return -1;
 	}
 
-	if (chmod(SYSLOG_PATH, 0750)) {
-		perror("chmod " SYSLOG_PATH);
+	if (chmod(log_path, 0750)) {
+		fprintf(stderr, "chmod %s: %s\n", log_path, strerror(errno));
 		return -1;
 	}
 
-	if (chdir(SYSLOG_PATH)) {
-		perror("cd " SYSLOG_PATH);
+	if (chdir(log_path)) {
+		fprintf(stderr, "cd %s: %s\n", log_path, strerror(errno));
 		return -1;
 	}
 
-	if (dochroot && chroot(SYSLOG_PATH) != 0) {
-		perror("chroot " SYSLOG_PATH);
+	/* log_path may be relative to the previous working directory */
+	if (dochroot && chroot(".") != 0) {
+		fprintf(stderr, "chroot %s: %s\n", log_path, strerror(errno));
 		return -1;
 	}
 
@@ -241,40 +1246,73 @@ int main(int argc, char **argv)
 
 	process_options(argc, argv);
 
+	if (config_path != NULL) {
+		logmgr = rules_backend_create(config_path, logmgr);
+		if (logmgr == NULL)
+			return EXIT_FAILURE;
+	} else if (log_cfg.forward_to != NULL && logmgr != forward_backend) {
+		logmgr = forward_backend_tee(logmgr);
+	}
+
 	signal_setup();
 
-	sfd = mksock(SYSLOG_SOCKET);
+	sfd = mksock(socket_path, rcvbuf, rate_limit > 0);
 	if (sfd < 0)
 		return EXIT_FAILURE;
 
-	if (uid > 0 && gid > 0 && chown(SYSLOG_SOCKET, uid, gid) != 0) {
-		perror("chown " SYSLOG_SOCKET);
+	if (uid > 0 && gid > 0 && chown(socket_path, uid, gid) != 0) {
+		fprintf(stderr, "chown %s: %s\n", socket_path,
+			strerror(errno));
 		return -1;
 	}
 
+	if (stats_path != NULL) {
+		stats_fd = stats_socket(stats_path);
+		if (stats_fd < 0)
+			return EXIT_FAILURE;
+
+		if (uid > 0 && gid > 0 && chown(stats_path, uid, gid) != 0) {
+			fprintf(stderr, "chown %s: %s\n", stats_path,
+				strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
 	if (chroot_setup())
 		return EXIT_FAILURE;
 
 	if (user_setup())
 		return EXIT_FAILURE;
 
-	if (logmgr->init(logmgr, log_flags, max_size))
-		goto out;
+	if (archive_init(compress_method, &retention))
+		return EXIT_FAILURE;
 
-	while (syslog_run) {
-		if (syslog_rotate) {
-			logmgr->rotate(logmgr);
-			syslog_rotate = 0;
-		}
+	if (rx_setup())
+		goto out_rx;
 
-		handle_data(sfd);
+	if (logmgr->init(logmgr, &log_cfg))
+		goto out;
+
+	if (threaded) {
+		if (run_threaded(sfd))
+			goto out;
+	} else {
+		run_single_threaded(sfd);
 	}
 
 	status = EXIT_SUCCESS;
 out:
 	logmgr->cleanup(logmgr);
+out_rx:
+	rx_cleanup();
+	archive_cleanup();
 	if (sfd > 0)
 		close(sfd);
-	unlink(SYSLOG_SOCKET);
+	unlink(socket_path);
+	if (stats_fd >= 0) {
+		stats_cleanup();
+		close(stats_fd);
+		unlink(stats_path);
+	}
 	return status;
 }
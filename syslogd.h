@@ -5,16 +5,33 @@
 
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 
 #include "config.h"
 
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#endif
+
 
 #define SYSLOG_SOCKET "/dev/log"
 #define SYSLOG_PATH "/var/log/syslog"
 #define DEFAULT_USER "syslogd"
 #define DEFAULT_GROUP "syslogd"
 
+/* maximum size of a message received through the syslog socket */
+#define SYSLOG_MSG_MAX 2048
+
+#define SYSLOG_NUM_FACILITIES 24
+#define SYSLOG_NUM_LEVELS 8
+
+/* FNV-1a string hash, used for ident strings */
+#define IDENT_HASH_INIT 2166136261U
+#define IDENT_HASH_STEP(h, c) (((h) ^ (uint8_t)(c)) * 16777619U)
+
 
 /*
   encapsulates the split up data from a message received
@@ -27,6 +44,23 @@ typedef struct {
 	pid_t pid;
 	const char *ident;
 	const char *message;
+
+	/* IDENT_HASH of the ident string, if there is one */
+	uint32_t ident_hash;
+
+	/* RFC 5424 header fields, NULL if not present */
+	const char *hostname;
+	const char *msgid;
+
+	/* RFC 5424 structured data elements, verbatim including brackets */
+	const char *sdata;
+
+	/*
+	  Log stream to write to, as selected by the routing rules. NULL
+	  for the default, i.e. the ident or else the facility name.
+	 */
+	const char *stream;
+	uint32_t stream_hash;
 } syslog_msg_t;
 
 
@@ -52,27 +86,690 @@ enum {
 	LOG_ROTATE_SIZE_LIMIT = 0x10,
 };
 
+enum {
+	/* Flush written log data to disk using fsync(). */
+	LOG_SYNC_FULL = 0,
+
+	/* Flush written log data to disk using fdatasync(). */
+	LOG_SYNC_DATA = 1,
+
+	/* Never explicitly flush log data, leave it to the kernel. */
+	LOG_SYNC_NONE = 2,
+};
+
+/*
+  Settings passed to a backend on initialization.
+ */
+typedef struct {
+	/* A combination of LOG_ROTATE_* flags. */
+	int flags;
+
+	/* Size limit for LOG_ROTATE_SIZE_LIMIT. */
+	size_t sizelimit;
+
+	/* One of the LOG_SYNC_* modes. */
+	int sync_mode;
+
+	/*
+	  If both are zero, data is synced after every message. Otherwise,
+	  syncs are grouped and done at the latest after sync_count messages
+	  (if non-zero) or sync_interval milliseconds (if non-zero) after the
+	  first unsynced message, bounding the amount of data lost on a crash.
+	 */
+	unsigned int sync_count;
+	unsigned int sync_interval;
+
+	/*
+	  If set, messages with a level of critical or above are synced
+	  immediately, regardless of the sync mode.
+	 */
+	bool sync_urgent;
+
+	/*
+	  Size of the per log stream buffer in bytes. Zero means write
+	  every message out immediately.
+	 */
+	size_t buffer_size;
+
+	/*
+	  Maximum time in milliseconds that a message can sit in a buffer
+	  before it is written out.
+	 */
+	unsigned int flush_interval;
+
+	/*
+	  Maximum number of log streams that are kept open at the same
+	  time. Zero means no limit.
+	 */
+	size_t max_open;
+
+	/*
+	  If non-zero, disk space for log files is preallocated in chunks
+	  of this many bytes (but not beyond the size limit), without
+	  changing the file size. It is released again when the file is
+	  closed.
+	 */
+	size_t prealloc;
+
+	/*
+	  Address of a remote collector for the forwarding backend, as
+	  "udp://host[:port]" or "tcp://host[:port]".
+	 */
+	const char *forward_to;
+
+	/*
+	  Maximum size of the file that messages are kept in while the
+	  collector cannot keep up or is not reachable. Zero means they are
+	  dropped instead.
+	 */
+	size_t spool_size;
+} log_config_t;
+
+/* Called for each log stream by the stream_stats backend function. */
+typedef void (*log_stream_fn)(void *user, const char *name, size_t namelen,
+			      uint64_t messages, uint64_t bytes);
+
 typedef struct log_backend_t {
-	int (*init)(struct log_backend_t *log, int flags, size_t sizelimit);
+	int (*init)(struct log_backend_t *log, const log_config_t *cfg);
 
 	void (*cleanup)(struct log_backend_t *log);
 
 	int (*write)(struct log_backend_t *log, const syslog_msg_t *msg);
 
 	void (*rotate)(struct log_backend_t *log);
+
+	/*
+	  Called periodically from the main loop to perform deferred work
+	  that is due, e.g. syncing log data to disk. Returns the number of
+	  milliseconds until it wants to be called again, or -1 if nothing
+	  is pending.
+	 */
+	int (*tick)(struct log_backend_t *log);
+
+	/*
+	  Report the number of messages and bytes written to each log
+	  stream through a callback. Must be called from the same thread
+	  as write().
+	 */
+	void (*stream_stats)(struct log_backend_t *log, log_stream_fn fn,
+			     void *user);
+
+	/*
+	  Optional, reload the configuration of the backend. If that fails,
+	  the old configuration is kept and -1 is returned.
+	 */
+	int (*reload)(struct log_backend_t *log);
 } log_backend_t;
 
 
 extern log_backend_t *logmgr;
 
+/* Get a backend implementation by name, or NULL if there is none. */
+log_backend_t *log_backend_by_name(const char *name);
+
+/*
+  Create a backend that routes messages to other backends, according to
+  the rules in a configuration file. The "file" action of the rules uses
+  the given fallback backend. The file is read immediately, so errors are
+  reported before the daemon starts, and again on reload through its
+  absolute path. No file descriptor is kept open for that, since it
+  would allow escaping from a chroot.
+ */
+log_backend_t *rules_backend_create(const char *path,
+				    log_backend_t *fallback);
+
+/*
+  Backend that writes messages to the binary log store described below,
+  instead of text files.
+ */
+extern log_backend_t *store_backend;
+
+/*
+  Backend that forwards messages to a remote collector over UDP or TCP,
+  as RFC 5424 messages with octet counting framing.
+ */
+extern log_backend_t *forward_backend;
+
+/*
+  Make the forwarding backend also write every message to a local
+  backend, which is initialized, ticked and cleaned up along with it.
+  Returns the forwarding backend.
+ */
+log_backend_t *forward_backend_tee(log_backend_t *local);
+
+/*
+  On disk format of the binary log store, written by the "store" backend
+  and read by the logquery program. Everything is in host byte order.
+
+  Messages are appended to segment files named store.<number>.seg, as a
+  sequence of records that are padded to a multiple of 8 bytes. Records
+  are grouped into blocks of at most STORE_BLOCK_SIZE bytes. Each ident
+  is assigned an ID per segment, defined by a record with the facility
+  set to STORE_IDENT_RECORD that precedes its first use.
+
+  A sidecar store.<number>.idx contains an entry for every completed
+  block and every ident definition. Records written after the last
+  completed block are not indexed yet. When a segment is sealed, its
+  index is rewritten with all ident entries first, followed by all
+  block entries, and the header flag STORE_SEALED set. Sealed segments
+  are never modified again.
+ */
+#define STORE_SEG_MAGIC "USLGSEG1"
+#define STORE_IDX_MAGIC "USLGIDX1"
+#define STORE_VERSION 1
+
+#define STORE_BLOCK_SIZE 65536
+#define STORE_IDENT_RECORD 0xFF
+
+enum {
+	STORE_SEALED = 0x01,
+};
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+
+	/* only valid if sealed */
+	uint32_t idents;
+	uint32_t blocks;
+	int64_t min_time;
+	int64_t max_time;
+} store_header_t;
+
+typedef struct {
+	/* size including the header and the padding */
+	uint32_t size;
+	uint8_t facility;
+	uint8_t level;
+	uint16_t length;
+	int64_t timestamp;
+	uint32_t pid;
+
+	/* ident ID, 0 if the message has no ident */
+	uint32_t ident;
+
+	/* followed by length bytes of message or ident name */
+} store_record_t;
+
+enum {
+	STORE_IDX_IDENT = 1,
+	STORE_IDX_BLOCK = 2,
+};
+
+typedef struct {
+	/* one of STORE_IDX_*, and the size including the padding */
+	uint32_t type;
+	uint32_t size;
+} store_idx_entry_t;
+
+typedef struct {
+	store_idx_entry_t hdr;
+	uint32_t id;
+	uint32_t length;
+
+	/* followed by the name */
+} store_idx_ident_t;
+
+typedef struct {
+	store_idx_entry_t hdr;
+	uint64_t offset;
+	uint32_t length;
+	uint32_t count;
+	int64_t min_time;
+	int64_t max_time;
+
+	/* bit (id % 64) is set for every ident used in the block */
+	uint64_t ident_mask;
+} store_idx_block_t;
+
+#define STORE_ALIGN(x) (((x) + 7) & ~((size_t)7))
+
+/*
+  A single producer, single consumer lock free queue of received and
+  parsed messages, used to hand them from the receiving thread over to
+  the thread that writes them to the backend.
+ */
+typedef struct {
+	/* set if the message was successfully parsed */
+	bool valid;
+
+	syslog_msg_t msg;
+
+	/* the raw message, referenced by the pointers in msg */
+	char data[SYSLOG_MSG_MAX];
+} msg_slot_t;
+
+typedef struct {
+	msg_slot_t *slots;
+	size_t mask;
+
+	/* eventfd used to wake up the consumer */
+	int efd;
+
+	/* next slot to be written, only modified by the producer */
+	size_t head __attribute__((aligned(64)));
+
+	/* number of messages dropped because the queue was full */
+	uint64_t drops;
+
+	/* maximum number of messages in the queue so far */
+	size_t high_water;
+
+	/* next slot to be read, only modified by the consumer */
+	size_t tail __attribute__((aligned(64)));
+
+	/* set by the consumer while waiting for messages */
+	int sleeping;
+} msgring_t;
+
+int msgring_init(msgring_t *ring, size_t count);
+
+void msgring_cleanup(msgring_t *ring);
+
+/* Producer side: number of free slots. */
+size_t msgring_space(msgring_t *ring);
+
+/* Producer side: get the i-th free slot. */
+msg_slot_t *msgring_producer_slot(msgring_t *ring, size_t i);
+
+/* Producer side: hand the first count free slots over to the consumer. */
+void msgring_publish(msgring_t *ring, size_t count);
+
+/* Producer side: account for messages that did not fit into the queue. */
+void msgring_drop(msgring_t *ring, size_t count);
+
+/* Consumer side: number of messages in the queue. */
+size_t msgring_available(msgring_t *ring);
+
+/* Consumer side: get the i-th queued message. */
+msg_slot_t *msgring_consumer_slot(msgring_t *ring, size_t i);
+
+/* Consumer side: return the first count slots to the producer. */
+void msgring_release(msgring_t *ring, size_t count);
+
+/*
+  Consumer side: wait at most timeout milliseconds (or forever if
+  negative) for messages to become available. If fd is not negative,
+  also stop waiting if it becomes readable and return true in that case.
+ */
+bool msgring_wait(msgring_t *ring, int timeout, int fd);
+
+/* Approximate number of messages in the queue, safe from any thread. */
+size_t msgring_depth(msgring_t *ring);
+
+/* number of buckets of the fsync latency histogram, without +Inf */
+#define STATS_FSYNC_BUCKETS 10
+
+/*
+  Runtime statistics of the daemon. Every counter is only ever updated by
+  a single thread, using STATS_ADD, so other threads can read them without
+  locking.
+ */
+typedef struct {
+	/* updated by the receiving thread */
+	uint64_t messages[SYSLOG_NUM_FACILITIES][SYSLOG_NUM_LEVELS];
+	uint64_t bytes[SYSLOG_NUM_FACILITIES][SYSLOG_NUM_LEVELS];
+	uint64_t parse_errors;
+
+	/* messages discarded by the per sender rate limit */
+	uint64_t ratelimited;
+
+	/* datagrams dropped by the kernel, as reported by SO_RXQ_OVFL */
+	uint64_t kernel_drops;
+
+	/* updated by the writing thread */
+	uint64_t write_errors;
+	uint64_t rotations;
+
+	/* current size of the live log files of the file backend */
+	uint64_t live_bytes;
+
+	/* log files closed to stay below max_open, and opened again */
+	uint64_t evictions;
+	uint64_t reopens;
+
+	/* fsync latency histogram, the last bucket is +Inf */
+	uint64_t fsyncs;
+	uint64_t fsync_us;
+	uint64_t fsync_max_us;
+	uint64_t fsync_hist[STATS_FSYNC_BUCKETS + 1];
+
+	/* updated by the archive thread */
+	uint64_t compressed;
+	uint64_t compress_in_bytes;
+	uint64_t compress_out_bytes;
+	uint64_t compress_errors;
+	uint64_t expired;
+	uint64_t expired_bytes;
+
+	/* current size of the rotated files known to the retention policy */
+	uint64_t rotated_bytes;
+
+	/* rotated files that could not be synced or closed */
+	uint64_t archive_errors;
+
+	/* updated by the forwarding backend, from the writing thread */
+	uint64_t forward_spooled;
+	uint64_t forward_dropped;
+	uint64_t forward_errors;
+
+	/* current amount of unsent messages in the spool file */
+	uint64_t forward_spool_bytes;
+} syslog_stats_t;
+
+#define STATS_ADD(counter, n) \
+	__atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+enum {
+	STATS_FORMAT_TEXT = 0,
+	STATS_FORMAT_PROMETHEUS = 1,
+};
+
+extern syslog_stats_t stats;
+
+/* Account for a successfully parsed message of len bytes. */
+void stats_message(const syslog_msg_t *msg, size_t len);
+
+/* Account for an fsync or fdatasync that took us microseconds. */
+void stats_fsync(uint64_t us);
+
+/*
+  Write all statistics in one of the STATS_FORMAT_* formats. The ring is
+  the queue of the threaded mode, or NULL. Must be called from the thread
+  that writes to the backend.
+ */
+void stats_dump(FILE *out, int format, msgring_t *ring);
+
+/*
+  Create a listening unix stream socket for reading statistics. A client
+  connects, optionally sends "text" or "prometheus" terminated by a line
+  break, and gets the statistics in that format.
+ */
+int stats_socket(const char *path);
+
+/*
+  Accept clients on the statistics socket. They are served without ever
+  blocking, by stats_tick(). Clients that do not send a request or read
+  the response in time are dropped.
+ */
+void stats_serve(int fd, msgring_t *ring);
+
+/*
+  Continue serving the accepted clients. Returns the number of
+  milliseconds until it wants to be called again, or -1 if there are no
+  clients. Must be called from the thread that writes to the backend.
+ */
+int stats_tick(msgring_t *ring);
+
+/* Drop all clients of the statistics socket. */
+void stats_cleanup(void);
+
+/*
+  Token bucket rate limiting of messages per sender, keyed on the PID or
+  UID passed along by the kernel. The table has a fixed number of sets,
+  each holding a few senders; if a set is full, the least recently
+  active sender is replaced.
+ */
+#define RATELIMIT_SETS 1024
+#define RATELIMIT_WAYS 4
+
+typedef struct {
+	bool used;
+	uint32_t key;
+
+	/* most recent sender credentials */
+	pid_t pid;
+	uid_t uid;
+
+	/* monotonic time in milliseconds of the last message */
+	long long last;
+
+	/* bucket fill level in 1/1000 messages */
+	long long tokens;
+
+	/* messages discarded since the last report */
+	uint64_t suppressed;
+} ratelimit_entry_t;
+
+typedef struct {
+	ratelimit_entry_t *table;
+
+	/* messages per second and maximum bucket size */
+	unsigned int rate;
+	unsigned int burst;
+	bool by_uid;
+
+	/* unreported suppressed messages of replaced senders */
+	uint64_t evicted_suppressed;
+} ratelimit_t;
+
+/* Called by ratelimit_report(), with a NULL entry for replaced senders. */
+typedef void (*ratelimit_fn)(void *user, const ratelimit_entry_t *e,
+			     uint64_t count);
+
+int ratelimit_init(ratelimit_t *rl, unsigned int rate, unsigned int burst,
+		   bool by_uid);
+
+void ratelimit_cleanup(ratelimit_t *rl);
+
+/*
+  Take a token from the bucket of a sender. Returns false if the message
+  should be discarded. The time is in milliseconds on a monotonic clock.
+ */
+bool ratelimit_check(ratelimit_t *rl, pid_t pid, uid_t uid, long long now);
+
+/* Report and reset the number of discarded messages of each sender. */
+void ratelimit_report(ratelimit_t *rl, ratelimit_fn fn, void *user);
+
+#ifdef HAVE_LINUX_IO_URING_H
+/*
+  A minimal wrapper for the io_uring system calls.
+ */
+typedef struct {
+	int fd;
+
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_len;
+	size_t cq_len;
+	size_t sqes_len;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	unsigned cq_entries;
+	struct io_uring_cqe *cqes;
+
+	/* local copy of the submission queue tail */
+	unsigned sqe_tail;
+
+	/* number of prepared entries not yet submitted to the kernel */
+	unsigned to_submit;
+
+	/* number of prepared or submitted entries not yet completed */
+	unsigned inflight;
+} uring_t;
+
+int uring_init(uring_t *ring, unsigned entries);
+
+void uring_cleanup(uring_t *ring);
+
+int uring_register_buffers(uring_t *ring, const struct iovec *iov,
+			   unsigned count);
+
+/*
+  Get a cleared submission queue entry, or NULL if either queue is full
+  and completions have to be reaped first.
+ */
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+
+/*
+  Submit all prepared entries and optionally wait for wait_nr
+  completions.
+ */
+int uring_submit(uring_t *ring, unsigned wait_nr);
+
+/* Get the next completion, or NULL if there is none. */
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring);
+
+/* Mark the completion returned by uring_peek_cqe() as consumed. */
+void uring_cqe_seen(uring_t *ring);
+#endif
+
 /*
   Parse a message string received from the syslog socket and produce
-  a split up representation for the message.
+  a split up representation for the message. Both RFC 5424 and the
+  traditional BSD format (RFC 3164) are accepted, the latter also with
+  an RFC 3339 time stamp or none at all.
  */
 int syslog_msg_parse(syslog_msg_t *msg, char *str);
 
-/* Create a unix DGRAM socket. */
-int mksock(const char *path);
+/*
+  Update the cached information about the local time used by the parser
+  (current year and UTC offset). Should be called regularly with the
+  current time, but is cheap to call often since it only does actual
+  work about once per minute.
+ */
+void syslog_clock_update(time_t now);
+
+/*
+  Vectorized string scanning for the message parser. SSE2 is used where
+  the compiler supports it, otherwise a scalar fallback. The AVX2 version
+  is only used if forced with scan_set_impl().
+ */
+
+/* Find the first a or b in a string, or else the terminating NUL. */
+char *scan_delim(const char *str, int a, int b);
+
+/* Get the length of a string without trailing white space. */
+size_t scan_trim(const char *str, size_t len);
+
+/*
+  Force a specific implementation ("scalar", "sse2" or "avx2"). Returns
+  -1 if it is not available on this machine.
+ */
+int scan_set_impl(const char *name);
+
+/* Name of the implementation in use. */
+const char *scan_impl(void);
+
+enum {
+	COMPRESS_NONE = 0,
+	COMPRESS_GZIP = 1,
+	COMPRESS_ZSTD = 2,
+};
+
+/*
+  Get a COMPRESS_* method by name ("none", "gzip" or "zstd"). Returns -1
+  if the name is unknown or support for the method was not compiled in.
+ */
+int compress_method_from_string(const char *name);
+
+/* Limits for the rotated files kept per log stream, 0 means no limit. */
+typedef struct {
+	/* number of rotated files */
+	unsigned int count;
+
+	/* age in seconds, based on the modification time */
+	unsigned int max_age;
+
+	/* total size of the rotated files */
+	uint64_t bytes;
+
+	/*
+	  Size of all live and rotated log files together. Rotated files
+	  of the log streams that use more than their share are removed
+	  first, oldest first.
+	 */
+	uint64_t budget;
+} retention_t;
+
+enum {
+	/* fsync the file before closing it */
+	ARCHIVE_SYNC = 0x01,
+
+	/* fdatasync the file before closing it */
+	ARCHIVE_DATASYNC = 0x02,
+
+	/* release disk space preallocated past the end of the file */
+	ARCHIVE_TRIM = 0x04,
+};
+
+/*
+  Start a background thread that takes care of rotated log files in the
+  current directory: it finishes writing them, compresses them with the
+  given method and removes old ones according to the retention limits.
+  Leftovers of an earlier run that was interrupted are cleaned up, or
+  queued for compression. If neither compression nor retention limits
+  are set, the directory is left alone and the thread is only started
+  once the first rotated file is handed over for finishing.
+ */
+int archive_init(int method, const retention_t *retention);
+
+/*
+  Hand over a rotated log file. If fd is not -1, it is the still open
+  file, which is synced according to the ARCHIVE_* flags and closed
+  first. If the thread is not running or too far behind, that is done
+  right away instead.
+ */
+void archive_submit(const char *path, int fd, int flags);
+
+/*
+  Stop the archive thread. Queued files are closed, but left uncompressed
+  until the next start.
+ */
+void archive_cleanup(void);
+
+/*
+  Called by the file backend when live log files grew. Wakes up the
+  archive thread if they exceed the disk budget together with the rotated
+  files and there are rotated files that can be removed.
+ */
+void archive_check_budget(void);
+
+/*
+  Retention of rotated log files, used by the archive thread. Rotated
+  files are indexed by a single scan of the directory on startup and
+  then tracked as they are added, so the limits can be enforced without
+  scanning the directory again.
+ */
+void retention_init(const retention_t *limits);
+
+/*
+  Index the rotated files in the current directory. If compressed is
+  set, uncompressed files are skipped, they are added once compressed.
+ */
+void retention_scan(bool compressed);
+
+/* Add a rotated file and apply the limits to its stream. */
+void retention_add(const char *path);
+
+/*
+  Remove files older than the age limit. Returns the time at which the
+  next one expires, or 0 if there is none.
+ */
+time_t retention_expire(time_t now);
+
+/* Remove rotated files until they fit into the disk budget. */
+void retention_budget(uint64_t live);
+
+void retention_cleanup(void);
+
+/*
+  Create a unix DGRAM socket. If rcvbuf is > 0, the receive buffer size
+  is set to it. Kernel side drops are reported through SO_RXQ_OVFL
+  ancillary data if the kernel supports it. If passcred is set, sender
+  credentials are received as SCM_CREDENTIALS ancillary data.
+ */
+int mksock(const char *path, int rcvbuf, bool passcred);
 
 const char *level_id_to_string(int level);
 
@@ -82,4 +779,23 @@ int level_id_from_string(const char *level);
 
 int facility_id_from_string(const char *fac);
 
+uint32_t ident_hash(const char *str);
+
+/* Buffer size required by format_prefix(). */
+#define FORMAT_PREFIX_MAX 128
+
+/*
+  Format a UTC time stamp in ISO 8601 format (without brackets) into a
+  buffer of at least 32 bytes and return the length. The most recently
+  used time stamp is cached.
+ */
+size_t format_timestamp(char *out, time_t t);
+
+/*
+  Format the "[time][facility][level][pid] " prefix of a log line, with
+  the facility part only if requested. Returns the length, or 0 if the
+  message has an invalid facility or level.
+ */
+size_t format_prefix(char *out, const syslog_msg_t *msg, bool facility);
+
 #endif /* LOGFILE_H */
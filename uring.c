@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "syslogd.h"
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+			      unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg,
+				 unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring_t *ring, unsigned entries)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+
+	ring->fd = sys_io_uring_setup(entries, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_len = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_len > ring->sq_len)
+			ring->sq_len = ring->cq_len;
+		ring->cq_len = 0;
+	}
+
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd,
+			    IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED)
+		goto fail;
+
+	if (ring->cq_len > 0) {
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring->fd,
+				    IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED)
+			goto fail_sq;
+	} else {
+		ring->cq_ptr = ring->sq_ptr;
+	}
+
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto fail_cq;
+
+	sq = ring->sq_ptr;
+	cq = ring->cq_ptr;
+
+	ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring->sq_entries = p.sq_entries;
+
+	ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	ring->cq_entries = p.cq_entries;
+	return 0;
+fail_cq:
+	if (ring->cq_len > 0)
+		munmap(ring->cq_ptr, ring->cq_len);
+fail_sq:
+	munmap(ring->sq_ptr, ring->sq_len);
+fail:
+	close(ring->fd);
+	ring->fd = -1;
+	return -1;
+}
+
+void uring_cleanup(uring_t *ring)
+{
+	munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_len > 0)
+		munmap(ring->cq_ptr, ring->cq_len);
+	munmap(ring->sq_ptr, ring->sq_len);
+	close(ring->fd);
+}
+
+int uring_register_buffers(uring_t *ring, const struct iovec *iov,
+			   unsigned count)
+{
+	return sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS,
+				     iov, count);
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+{
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	if (ring->sqe_tail - head >= ring->sq_entries)
+		return NULL;
+	if (ring->inflight >= ring->cq_entries)
+		return NULL;
+
+	idx = ring->sqe_tail & ring->sq_mask;
+	ring->sq_array[idx] = idx;
+	ring->sqe_tail += 1;
+	ring->to_submit += 1;
+	ring->inflight += 1;
+
+	sqe = ring->sqes + idx;
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+int uring_submit(uring_t *ring, unsigned wait_nr)
+{
+	unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+
+	if (ring->to_submit == 0 && wait_nr == 0)
+		return 0;
+
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+	do {
+		ret = sys_io_uring_enter(ring->fd, ring->to_submit, wait_nr,
+					 flags);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -1;
+
+	if ((unsigned)ret < ring->to_submit) {
+		ring->to_submit -= ret;
+	} else {
+		ring->to_submit = 0;
+	}
+	return 0;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring)
+{
+	unsigned head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return ring->cqes + (head & ring->cq_mask);
+}
+
+void uring_cqe_seen(uring_t *ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+	ring->inflight -= 1;
+}